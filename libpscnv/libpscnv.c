@@ -191,3 +191,65 @@ int pscnv_obj_eng_new(int fd, uint32_t cid, uint32_t handle, uint32_t oclass, ui
 	req.flags = flags;
 	return drmCommandWriteRead(fd, DRM_PSCNV_OBJ_ENG_NEW, &req, sizeof(req));
 }
+
+int pscnv_vram_budget(int fd, uint64_t *vram_usage, uint64_t *vram_swapped, uint64_t *vram_demand, uint64_t *vram_share, uint64_t *vram_free) {
+	int ret;
+	struct drm_pscnv_vram_budget req;
+	ret = drmCommandWriteRead(fd, DRM_PSCNV_VRAM_BUDGET, &req, sizeof(req));
+	if (ret)
+		return ret;
+	if (vram_usage)
+		*vram_usage = req.vram_usage;
+	if (vram_swapped)
+		*vram_swapped = req.vram_swapped;
+	if (vram_demand)
+		*vram_demand = req.vram_demand;
+	if (vram_share)
+		*vram_share = req.vram_share;
+	if (vram_free)
+		*vram_free = req.vram_free;
+	return 0;
+}
+
+int pscnv_pressure_notify(int fd, int32_t eventfd, uint32_t mask, uint32_t *events) {
+	int ret;
+	struct drm_pscnv_pressure_notify req;
+	req.fd = eventfd;
+	req.mask = mask;
+	req._pad = 0;
+	ret = drmCommandWriteRead(fd, DRM_PSCNV_PRESSURE_NOTIFY, &req, sizeof(req));
+	if (ret)
+		return ret;
+	if (events)
+		*events = req.events;
+	return 0;
+}
+
+int pscnv_gem_residency(int fd, uint32_t handle, uint32_t *n_chunks, uint8_t *residency, uint64_t *chunk_size, uint64_t *vram_bytes, uint64_t *sysram_bytes, uint64_t *swapped_bytes) {
+	int ret;
+	struct drm_pscnv_gem_residency req;
+	req.handle = handle;
+	req.n_chunks = (residency && n_chunks) ? *n_chunks : 0;
+	req.residency = (uint64_t)(uintptr_t)residency;
+	ret = drmCommandWriteRead(fd, DRM_PSCNV_GEM_RESIDENCY, &req, sizeof(req));
+	if (ret)
+		return ret;
+	if (n_chunks)
+		*n_chunks = req.n_chunks;
+	if (chunk_size)
+		*chunk_size = req.chunk_size;
+	if (vram_bytes)
+		*vram_bytes = req.vram_bytes;
+	if (sysram_bytes)
+		*sysram_bytes = req.sysram_bytes;
+	if (swapped_bytes)
+		*swapped_bytes = req.swapped_bytes;
+	return 0;
+}
+
+int pscnv_gem_advise(int fd, uint32_t handle, uint32_t advice) {
+	struct drm_pscnv_gem_advise req;
+	req.handle = handle;
+	req.advice = advice;
+	return drmCommandWriteRead(fd, DRM_PSCNV_GEM_ADVISE, &req, sizeof(req));
+}
@@ -20,6 +20,23 @@
 #define PSCNV_GEM_SYSRAM_NOSNOOP	0x0000000c
 #define PSCNV_GEM_GART			PSCNV_GEM_SYSRAM_SNOOP	/* compat */
 
+#define PSCNV_RESIDENCY_UNALLOCATED	0
+#define PSCNV_RESIDENCY_VRAM		1
+#define PSCNV_RESIDENCY_SYSRAM		2
+#define PSCNV_RESIDENCY_SWAPPED		3
+/* residency of chunk i in the array returned by pscnv_gem_residency */
+#define PSCNV_RESIDENCY_GET(residency, i) (((residency)[(i) / 4] >> (2 * ((i) % 4))) & 3)
+
+#define PSCNV_ADVICE_NORMAL		0	/* no special treatment */
+#define PSCNV_ADVICE_WILLNEED		1	/* swap in before other BOs */
+#define PSCNV_ADVICE_DONTNEED		2	/* swap in after other BOs */
+
+#define PSCNV_PRESSURE_SHARE_SHRINK	0x00000001	/* vram_share of the client got smaller */
+#define PSCNV_PRESSURE_EVICT		0x00000002	/* chunks of the client get swapped out */
+#define PSCNV_PRESSURE_HEADROOM		0x00000004	/* unused VRAM is available again */
+#define PSCNV_PRESSURE_ALL		0x00000007
+#define PSCNV_PRESSURE_FD_KEEP		(-2)
+
 int pscnv_getparam(int fd, uint64_t param, uint64_t *value);
 int pscnv_gem_new(int fd, uint32_t cookie, uint32_t flags, uint32_t tile_flags, uint64_t size, uint32_t *user, uint32_t *handle, uint64_t *map_handle);
 int pscnv_gem_info(int fd, uint32_t handle, uint32_t *cookie, uint32_t *flags, uint32_t *tile_flags, uint64_t *size, uint64_t *map_handle, uint32_t *user);
@@ -37,5 +54,9 @@ int pscnv_fifo_init(int fd, uint32_t cid, uint32_t pb_handle, uint32_t flags, ui
 int pscnv_fifo_init_ib(int fd, uint32_t cid, uint32_t pb_handle, uint32_t flags, uint32_t slimask, uint64_t ib_start, uint32_t ib_order);
 int pscnv_obj_eng_new(int fd, uint32_t cid, uint32_t handle, uint32_t oclass, uint32_t flags);
 #define pscnv_obj_gr_new pscnv_obj_eng_new
+int pscnv_gem_residency(int fd, uint32_t handle, uint32_t *n_chunks, uint8_t *residency, uint64_t *chunk_size, uint64_t *vram_bytes, uint64_t *sysram_bytes, uint64_t *swapped_bytes);
+int pscnv_gem_advise(int fd, uint32_t handle, uint32_t advice);
+int pscnv_pressure_notify(int fd, int32_t eventfd, uint32_t mask, uint32_t *events);
+int pscnv_vram_budget(int fd, uint64_t *vram_usage, uint64_t *vram_swapped, uint64_t *vram_demand, uint64_t *vram_share, uint64_t *vram_free);
 
 #endif
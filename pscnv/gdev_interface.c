@@ -8,6 +8,8 @@
 #include "pscnv_mem.h"
 #include "pscnv_vm.h"
 #include "pscnv_sysram.h"
+#include "pscnv_client.h"
+#include "pscnv_swapping.h"
 
 #define VS_START 0x20000000
 #define VS_END (1ull << 40)
@@ -23,6 +25,13 @@ int gdev_drv_vspace_alloc(struct drm_device *drm, uint64_t size, struct gdev_drv
 		return -ENOMEM;
 
 	vspace->filp = NULL; /* we don't need drm_filp in Gdev. */
+	
+	/* the gdev context belongs to the calling process, its memory is
+	 * accounted and swapped like that of DRM users */
+	if (current->mm) {
+		vspace->client = pscnv_client_get(drm, current);
+	}
+	
 	drv_vspace->priv = vspace;
 	
 	return 0;
@@ -67,6 +76,16 @@ int gdev_drv_chan_alloc(struct drm_device *drm, struct gdev_drv_vspace *drv_vspa
 	
 	chan->filp = NULL; /* we don't need drm_filp in Gdev. */
 	
+	if (vspace->client) {
+		chan->client = vspace->client;
+		mutex_lock(&dev_priv->clients->lock);
+		list_add_tail(&chan->client_list, &vspace->client->channels);
+		mutex_unlock(&dev_priv->clients->lock);
+		
+		/* the new channel may access all swapped memory */
+		pscnv_swapping_unpark_client(vspace->client);
+	}
+	
 	/* channel ID. */
 	cid = chan->cid;
 
@@ -187,10 +206,13 @@ int gdev_drv_bo_alloc(struct drm_device *drm, uint64_t size, uint32_t drv_flags,
 		} else {
 			flags |= PSCNV_MAP_USER;
 		}
+	} else if (vspace->client) {
+		/* swappable, BAR1 mappings can not follow a swapped chunk */
+		flags |= PSCNV_GEM_USER;
 	}
 
 	/* allocate physical memory space. */
-	if (!(bo = pscnv_mem_alloc(drm, size, flags, 0, 0, NULL))) {
+	if (!(bo = pscnv_mem_alloc(drm, size, flags, 0, 0, vspace->client))) {
 		ret = -ENOMEM;
 		goto fail_bo;
 	}
@@ -279,11 +301,20 @@ int gdev_drv_bo_map(struct drm_device *drm, struct gdev_drv_bo *drv_bo)
 {
 	struct pscnv_bo *bo = (struct pscnv_bo *)drv_bo->priv;
 	struct drm_nouveau_private *dev_priv = drm->dev_private;
+	int ret;
+
+	pscnv_bo_touch(bo);
 
 	switch (bo->flags & PSCNV_GEM_MEMTYPE_MASK) {
 		case PSCNV_GEM_VRAM_SMALL:
 		case PSCNV_GEM_VRAM_LARGE:
 			if (!bo->drm_map) {
+				/* keep the BAR1 mapping valid */
+				if (bo->flags & PSCNV_GEM_USER) {
+					ret = pscnv_swapping_pin_bo(bo);
+					if (ret)
+						return ret;
+				}
 				if (dev_priv->vm->map_user(bo))
 					return -EIO;
 			}
@@ -319,6 +350,7 @@ int gdev_drv_read32(struct drm_device *drm, struct gdev_drv_vspace *drv_vspace,
 {
 	struct pscnv_bo *bo = (struct pscnv_bo *)drv_bo->priv;
 
+	pscnv_bo_touch(bo);
 	*p = nv_rv32(bo, offset);
 
 	return 0;
@@ -329,6 +361,7 @@ int gdev_drv_write32(struct drm_device *drm, struct gdev_drv_vspace *drv_vspace,
 {
 	struct pscnv_bo *bo = (struct pscnv_bo *)drv_bo->priv;
 
+	pscnv_bo_touch(bo);
 	nv_wv32(bo, offset, val);
 
 	return 0;
@@ -343,6 +376,8 @@ int gdev_drv_read(struct drm_device *drm, struct gdev_drv_vspace *drv_vspace, st
 	
 	BUG_ON((size % 4) != 0);
 	
+	pscnv_bo_touch(bo);
+	
 	for (pos = 0; pos < size; pos += 4) {
 		buf32[pos/4] = nv_rv32(bo, offset + pos);
 	}
@@ -359,6 +394,8 @@ int gdev_drv_write(struct drm_device *drm, struct gdev_drv_vspace *drv_vspace, s
 
 	BUG_ON((size % 4) != 0);
 	
+	pscnv_bo_touch(bo);
+	
 	for (pos = 0; pos < size; pos += 4) {
 		nv_wv32(bo, offset + pos, buf32[pos/4]);
 	}
@@ -35,6 +35,8 @@
 #include "pscnv_vm.h"
 #include "pscnv_chan.h"
 #include "pscnv_dma.h"
+#include "pscnv_swapstore.h"
+#include "pscnv_sysram.h"
 
 #if 0
 static int
@@ -151,6 +153,27 @@ nouveau_debugfs_memory_info(struct seq_file *m, void *pos)
 	seq_printf(m, "VRAM usage (clients): %dKiB\n", (int)pscnv_clients_vram_usage(dev) >> 10);
 	seq_printf(m, "VRAM swapped: %dKiB\n", (int)pscnv_clients_vram_swapped(dev) >> 10);
 	seq_printf(m, "VRAM demand: %dKiB\n", (int)pscnv_clients_vram_demand(dev) >> 10);
+	if (dev_priv->swapstore) {
+		struct pscnv_swapstore *store = dev_priv->swapstore;
+		seq_printf(m, "Swapstore: %d chunks (%d shared), %dKiB in %dKiB\n",
+			atomic_read(&store->entries),
+			atomic_read(&store->shared),
+			(int)(atomic64_read(&store->stored_bytes) >> 10),
+			(int)(atomic64_read(&store->data_bytes) >> 10));
+		seq_printf(m, "Swapstore in shmem: %dKiB\n",
+			(int)(atomic64_read(&store->file_bytes) >> 10));
+	}
+	if (dev_priv->sysram_pool) {
+		struct pscnv_sysram_pool *pool = dev_priv->sysram_pool;
+		seq_printf(m, "Swap pool: %d of %d chunks, %d hits, %d misses\n",
+			pool->count, pscnv_swap_pool_size,
+			atomic_read(&pool->hits),
+			atomic_read(&pool->misses));
+	}
+	if (pscnv_swap_client_limit) {
+		seq_printf(m, "SYSRAM limit per client: %dKiB\n",
+			pscnv_swap_client_limit << 10);
+	}
 	
 	mutex_lock(&dev_priv->clients->lock);
 	if (!list_empty(&dev_priv->clients->list)) {
@@ -158,12 +181,13 @@ nouveau_debugfs_memory_info(struct seq_file *m, void *pos)
 	}
 	
 	list_for_each_entry(cur, &dev_priv->clients->list, clients) {
-		seq_printf(m, "client %d: used %dKiB, demand %dKiB, swapped %dKiB, swappable bo %d, swapped bo %d\n",
+		seq_printf(m, "client %d: used %dKiB, demand %dKiB, swapped %dKiB, swappable bo %d, swapped bo %d, pinned sysram %dKiB\n",
 			cur->pid, (int)atomic64_read(&cur->vram_usage) >> 10,
 				  (int)atomic64_read(&cur->vram_demand) >> 10,
 			          (int)atomic64_read(&cur->vram_swapped) >> 10,
 				  (int)(cur->swapping_options.size),
-				  (int)(cur->already_swapped.size));
+				  (int)(cur->already_swapped.size),
+				  (int)(atomic64_read(&cur->sysram_pages) << (PAGE_SHIFT - 10)));
 	}
 	mutex_unlock(&dev_priv->clients->lock);
 	return 0;
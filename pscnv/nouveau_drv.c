@@ -158,6 +158,26 @@ MODULE_PARM_DESC(vram_limit, "Limit usable VRAM to (MiB)");
 int pscnv_vram_limit = 0;
 module_param_named(vram_limit, pscnv_vram_limit, int, 0400);
 
+MODULE_PARM_DESC(swap_compress, "Keep swapped memory of idle clients compressed, see swap_ctx_delay");
+int pscnv_swap_compress = 0;
+module_param_named(swap_compress, pscnv_swap_compress, int, 0400);
+
+MODULE_PARM_DESC(swap_shmem_delay, "Move compressed swapped memory to shmem after (seconds), 0 = never");
+int pscnv_swap_shmem_delay = 0;
+module_param_named(swap_shmem_delay, pscnv_swap_shmem_delay, int, 0400);
+
+MODULE_PARM_DESC(swap_pool_size, "Number of DMA-mapped SYSRAM chunks to keep for swapping, 0 = none");
+int pscnv_swap_pool_size = 8;
+module_param_named(swap_pool_size, pscnv_swap_pool_size, int, 0400);
+
+MODULE_PARM_DESC(swap_client_limit, "Maximum of swapped and SYSRAM memory per client (MiB), 0 = unlimited");
+int pscnv_swap_client_limit = 0;
+module_param_named(swap_client_limit, pscnv_swap_client_limit, int, 0400);
+
+MODULE_PARM_DESC(swap_ctx_delay, "Move graphics contexts of channels idle for longer than (seconds) to SYSRAM, 0 = never");
+int pscnv_swap_ctx_delay = 0;
+module_param_named(swap_ctx_delay, pscnv_swap_ctx_delay, int, 0400);
+
 int nouveau_fbpercrtc;
 #if 0
 module_param_named(fbpercrtc, nouveau_fbpercrtc, int, 0400);
@@ -179,6 +199,10 @@ static struct drm_ioctl_desc nouveau_ioctls[] = {
 	DRM_IOCTL_DEF_DRV(PSCNV_OBJ_ENG_NEW, pscnv_ioctl_obj_eng_new, DRM_UNLOCKED),
 	DRM_IOCTL_DEF_DRV(PSCNV_FIFO_INIT_IB, pscnv_ioctl_fifo_init_ib, DRM_UNLOCKED),
 	DRM_IOCTL_DEF_DRV(PSCNV_COPY_TO_HOST, pscnv_ioctl_copy_to_host, DRM_UNLOCKED),
+	DRM_IOCTL_DEF_DRV(PSCNV_VRAM_BUDGET, pscnv_ioctl_vram_budget, DRM_UNLOCKED),
+	DRM_IOCTL_DEF_DRV(PSCNV_PRESSURE_NOTIFY, pscnv_ioctl_pressure_notify, DRM_UNLOCKED),
+	DRM_IOCTL_DEF_DRV(PSCNV_GEM_RESIDENCY, pscnv_ioctl_gem_residency, DRM_UNLOCKED),
+	DRM_IOCTL_DEF_DRV(PSCNV_GEM_ADVISE, pscnv_ioctl_gem_advise, DRM_UNLOCKED),
 };
 #elif defined(PSCNV_KAPI_DRM_IOCTL_DEF)
 static struct drm_ioctl_desc nouveau_ioctls[] = {
@@ -196,6 +220,10 @@ static struct drm_ioctl_desc nouveau_ioctls[] = {
 	DRM_IOCTL_DEF(DRM_PSCNV_OBJ_ENG_NEW, pscnv_ioctl_obj_eng_new, DRM_UNLOCKED),
 	DRM_IOCTL_DEF(DRM_PSCNV_FIFO_INIT_IB, pscnv_ioctl_fifo_init_ib, DRM_UNLOCKED),
 	DRM_IOCTL_DEF(DRM_PSCNV_COPY_TO_HOST, pscnv_ioctl_copy_to_host, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_VRAM_BUDGET, pscnv_ioctl_vram_budget, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_PRESSURE_NOTIFY, pscnv_ioctl_pressure_notify, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_GEM_RESIDENCY, pscnv_ioctl_gem_residency, DRM_UNLOCKED),
+	DRM_IOCTL_DEF(DRM_PSCNV_GEM_ADVISE, pscnv_ioctl_gem_advise, DRM_UNLOCKED),
 };
 #else
 #error "Unknown IOCTLDEF method."
@@ -322,6 +350,7 @@ static struct drm_driver driver = {
 	},
 #endif
 
+	.gem_open_object = pscnv_gem_open_object,
 	.gem_close_object = pscnv_gem_close_object,
 	.gem_free_object = pscnv_gem_free_object,
 
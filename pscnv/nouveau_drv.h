@@ -84,6 +84,8 @@ struct pscnv_dma;
 struct pscnv_ib_chan;
 struct pscnv_clients;
 struct pscnv_swapping;
+struct pscnv_swapstore;
+struct pscnv_sysram_pool;
 
 struct nouveau_channel {
 	struct drm_device *dev;
@@ -555,6 +557,11 @@ struct drm_nouveau_private {
 	struct pscnv_mm *vram_mm;
 	struct mutex vram_mutex;
 
+	/* user BOs whose last reference is gone, free_work frees them */
+	spinlock_t free_lock;
+	struct list_head free_list;
+	struct work_struct free_work;
+
 	/* for slow-path nv_wv32/nv_rv32 */
 	spinlock_t pramin_lock;
 	uint64_t pramin_start;
@@ -590,6 +597,8 @@ struct drm_nouveau_private {
 	struct pscnv_dma *dma;
 	struct pscnv_clients *clients;
 	struct pscnv_swapping *swapping;
+	struct pscnv_swapstore *swapstore;
+	struct pscnv_sysram_pool *sysram_pool;
 };
 
 #define NOUVEAU_CHECK_INITIALISED_WITH_RETURN do {            \
@@ -630,6 +639,11 @@ extern char *nouveau_perflvl;
 extern int nouveau_perflvl_wr;
 extern int pscnv_requested_chunk_size;
 extern int pscnv_vram_limit;
+extern int pscnv_swap_compress;
+extern int pscnv_swap_shmem_delay;
+extern int pscnv_swap_pool_size;
+extern int pscnv_swap_client_limit;
+extern int pscnv_swap_ctx_delay;
 
 #ifdef __linux__
 extern int nouveau_pci_suspend(struct pci_dev *pdev, pm_message_t pm_state);
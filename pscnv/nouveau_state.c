@@ -46,6 +46,8 @@
 #include "pscnv_dma.h"
 #include "pscnv_client.h"
 #include "pscnv_swapping.h"
+#include "pscnv_swapstore.h"
+#include "pscnv_sysram.h"
 #include "nvc0_vm.h"
 
 extern struct drm_device *pscnv_drm;
@@ -492,8 +494,11 @@ static void nouveau_card_takedown(struct drm_device *dev)
 
 	if (dev_priv->init_state == NOUVEAU_CARD_INIT_DONE) {
 		NV_INFO(dev, "Stopping card...\n");
+		pscnv_mem_flush_free(dev);
 		pscnv_dma_exit(dev);
 		pscnv_swapping_exit(dev);
+		pscnv_swapstore_exit(dev);
+		pscnv_sysram_pool_exit(dev);
 		pscnv_clients_exit(dev);
 		nouveau_backlight_exit(dev);
 		drm_irq_uninstall(dev);
@@ -621,6 +626,8 @@ int nouveau_load(struct drm_device *dev, unsigned long flags)
 	
 	pscnv_clients_init(dev);
 	pscnv_swapping_init(dev);
+	pscnv_swapstore_init(dev);
+	pscnv_sysram_pool_init(dev);
 
 	NV_DEBUG(dev, "vendor: 0x%X device: 0x%X\n",
 		 dev->pci_vendor, dev->pci_device);
@@ -355,7 +355,7 @@ nvc0_chan_ib_fault(struct pscnv_bo *ib, struct vm_area_struct *vma, struct vm_fa
 		case PSCNV_GEM_SYSRAM_SNOOP:
 		case PSCNV_GEM_SYSRAM_NOSNOOP:
 			remap_pfn_range(vma, vma->vm_start,
-				page_to_pfn(ib->chunks[0].pages[0].k),
+				page_to_pfn(sg_page(ib->chunks[0].sgt->sgl)),
 				vma->vm_end - vma->vm_start, PAGE_SHARED);
 			break;
 		default:
@@ -652,6 +652,28 @@ nvc0_chan_pause(struct pscnv_chan *ch)
 	return 0;
 }
 
+/* while the channel is paused, the owner writes IB_PUT into the shadow */
+static uint32_t
+nvc0_chan_read_ib_put(struct pscnv_chan *ch_base)
+{
+	struct nvc0_chan *ch = nvc0_ch(ch_base);
+	struct drm_device *dev = ch->base.dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct nvc0_fifo_engine *fifo = nvc0_fifo_eng(dev_priv->fifo);
+	uint32_t ib_put;
+	
+	spin_lock(&ch->ctrl_shadow_lock);
+	if (ch->ctrl_shadow &&
+	    (ch->ctrl_is_shadowed || ch->ctrl_restore_delayed)) {
+		ib_put = ch->ctrl_shadow[0x8c/4];
+	} else {
+		ib_put = nv_rv32(fifo->ctrl_bo, (ch->base.cid << 12) + 0x8c);
+	}
+	spin_unlock(&ch->ctrl_shadow_lock);
+	
+	return ib_put;
+}
+
 static int
 nvc0_chan_continue(struct pscnv_chan *ch)
 {
@@ -898,6 +920,7 @@ nvc0_chan_init(struct drm_device *dev)
 	che->base.pd_dump_chan = nvc0_pd_dump_chan;
 	che->base.do_chan_pause = nvc0_chan_pause;
 	che->base.do_chan_continue = nvc0_chan_continue;
+	che->base.read_ib_put = nvc0_chan_read_ib_put;
 	dev_priv->chan = &che->base;
 	spin_lock_init(&dev_priv->chan->ch_lock);
 	dev_priv->chan->ch_min = 1;
@@ -28,6 +28,7 @@
 #include "nouveau_enum.h"
 #include "pscnv_chan.h"
 #include "pscnv_vm.h"
+#include "pscnv_swapping.h"
 
 #include "nvc0_graph_error_names.inc"
 
@@ -190,6 +191,80 @@ nvc0_graph_chan_kill(struct pscnv_engine *eng, struct pscnv_chan *ch)
 	/* FIXME */
 }
 
+/* a paused channel may still be the current context of PGRAPH, which then
+ * holds parts of it on chip. Make PGRAPH save it to the grctx and forget
+ * about it, the same way the grctx template gets unloaded */
+static int
+nvc0_graph_chan_unload(struct pscnv_engine *eng, struct pscnv_chan *ch)
+{
+	struct drm_device *dev = eng->dev;
+	uint32_t cur = nv_rd32(dev, 0x409b00);
+	
+	if (!(cur & 0x80000000) || (cur & 0x0fffffff) != ch->bo->start >> 12)
+		return 0;
+	
+	nv_mask(dev, 0x409b04, 0x80000000, 0x00000000);
+	nv_wr32(dev, 0x409000, 0x00000100);
+	if (!nv_wait(dev, 0x409b00, 0x80000000, 0x00000000)) {
+		NV_ERROR(dev, "PGRAPH: channel %d unload timeout\n", ch->cid);
+		return -EBUSY;
+	}
+	
+	return 0;
+}
+
+/* the context and its buffers are only addressed through the vspace of the
+ * channel, so they may be moved to SYSRAM while the channel is paused */
+int
+nvc0_graph_chan_evict(struct pscnv_engine *eng, struct pscnv_chan *ch)
+{
+	struct nvc0_graph_chan *grch = ch->engdata[PSCNV_ENGINE_GRAPH];
+	int ret;
+	int i;
+	
+	ret = nvc0_graph_chan_unload(eng, ch);
+	if (ret)
+		return ret;
+	
+	ret = pscnv_swapping_evict_bo(grch->grctx);
+	if (ret)
+		return ret;
+	
+	ret = pscnv_swapping_evict_bo(grch->mmio);
+	if (ret)
+		return ret;
+	
+	for (i = 0; i < ARRAY_SIZE(grch->data); i++) {
+		if (!grch->data[i].mem)
+			continue;
+		ret = pscnv_swapping_evict_bo(grch->data[i].mem);
+		if (ret)
+			return ret;
+	}
+	
+	return 0;
+}
+
+int
+nvc0_graph_chan_restore(struct pscnv_engine *eng, struct pscnv_chan *ch)
+{
+	struct nvc0_graph_chan *grch = ch->engdata[PSCNV_ENGINE_GRAPH];
+	int ret;
+	int i;
+	
+	ret = pscnv_swapping_restore_bo(grch->grctx);
+	
+	if (!ret)
+		ret = pscnv_swapping_restore_bo(grch->mmio);
+	
+	for (i = 0; !ret && i < ARRAY_SIZE(grch->data); i++) {
+		if (grch->data[i].mem)
+			ret = pscnv_swapping_restore_bo(grch->data[i].mem);
+	}
+	
+	return ret;
+}
+
 #include "nvc0_graph_reg_lists.inc"
 
 /*******************************************************************************
@@ -803,6 +878,8 @@ nvc0_graph_ctor(struct drm_device *dev)
 	graph->base.chan_alloc = nvc0_graph_chan_alloc;
 	graph->base.chan_kill = nvc0_graph_chan_kill;
 	graph->base.chan_free = nvc0_graph_chan_free;
+	graph->base.chan_evict = nvc0_graph_chan_evict;
+	graph->base.chan_restore = nvc0_graph_chan_restore;
 	
 	/* unk4188b4 and unk4188b8 match the obj188b4 and obj188b8 of the
 	 * original pscnv.
@@ -248,6 +248,20 @@ nvc0_vspace_pgt(struct pscnv_vspace *vs, unsigned int pde)
 	return pt;
 }
 
+/* same as above, but only creates a missing page table if alloc is set.
+ * Rewriting PTEs of existing mappings must not allocate anything, it may run
+ * with bo->maps_lock held, which would nest with the locks taken to map the
+ * new page table */
+static inline struct nvc0_pgt *
+nvc0_vspace_pgt_get(struct pscnv_vspace *vs, unsigned int pde, bool alloc)
+{
+	if (alloc) {
+		return nvc0_vspace_pgt(vs, pde);
+	}
+	
+	return nvc0_vspace_pgt_or_null(vs, pde);
+}
+
 static void
 nvc0_pgt_del(struct pscnv_vspace *vs, struct nvc0_pgt *pgt)
 {
@@ -266,21 +280,26 @@ nvc0_pgt_del(struct pscnv_vspace *vs, struct nvc0_pgt *pgt)
 	kfree(pgt);
 }
 
-static int
-nvc0_vspace_do_unmap(struct pscnv_vspace *vs, uint64_t offset, uint64_t size)
+/* clear the PTEs of the given range, without any flushes. Ranges without a
+ * page table are skipped, unless alloc is set */
+static void
+nvc0_vspace_clear_ptes(struct pscnv_vspace *vs, uint64_t offset, uint64_t size,
+		       bool alloc)
 {
-	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
 	uint32_t space;
 
 	for (; size; offset += space) {
 		struct nvc0_pgt *pt;
 		int i, pte;
 
-		pt = nvc0_vspace_pgt(vs, NVC0_PDE(offset));
+		pt = nvc0_vspace_pgt_get(vs, NVC0_PDE(offset), alloc);
 		space = NVC0_VM_BLOCK_SIZE - (offset & NVC0_VM_BLOCK_MASK);
 		if (space > size)
 			space = size;
 		size -= space;
+		
+		if (!pt)
+			continue;
 
 		pte = NVC0_SPTE(offset);
 		for (i = 0; i < (space >> NVC0_SPAGE_SHIFT) * 8; i += 4)
@@ -293,6 +312,15 @@ nvc0_vspace_do_unmap(struct pscnv_vspace *vs, uint64_t offset, uint64_t size)
 		for (i = 0; i < (space >> NVC0_LPAGE_SHIFT) * 8; i += 4)
 			nv_wv32(pt->bo[0], pte * 8 + i, 0);
 	}
+}
+
+static int
+nvc0_vspace_do_unmap(struct pscnv_vspace *vs, uint64_t offset, uint64_t size)
+{
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	
+	nvc0_vspace_clear_ptes(vs, offset, size, true);
+	
 	dev_priv->vm->bar_flush(vs->dev);
 	nvc0_tlb_flush(vs);
 	
@@ -516,22 +544,24 @@ nvc0_vspace_place_map_chunk(struct pscnv_vspace *vs, struct pscnv_chunk *cnk,
 	return pscnv_mm_alloc(vs->mm, pscnv_chunk_size(cnk), flags, start, end, res);
 }
 
+/* write the PTEs for cnk at offset, without any flushes */
 static int
-nvc0_vspace_do_map_chunk(struct pscnv_vspace *vs, struct pscnv_chunk *cnk, uint64_t offset)
+nvc0_vspace_write_chunk_ptes(struct pscnv_vspace *vs, struct pscnv_chunk *cnk, uint64_t offset,
+			     bool alloc)
 {
 	struct pscnv_bo *bo = cnk->bo;
 	struct drm_device *dev = vs->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	uint32_t pfl0, pfl1;
 	struct pscnv_mm_node *reg;
-	int i;
+	struct scatterlist *sg;
+	int i, count;
 	unsigned long flags;
 	int s;
 	uint32_t psh, psz;
 	
 	unsigned int pde = NVC0_PDE(offset);
 	unsigned int pte = (offset & NVC0_VM_BLOCK_MASK) >> PAGE_SHIFT;
-	struct nvc0_pgt *pt = nvc0_vspace_pgt(vs, pde);
+	struct nvc0_pgt *pt = nvc0_vspace_pgt_get(vs, pde, alloc);
 
 	pfl0 = 1;
 	if (vs->vid >= 0 && (bo->flags & PSCNV_GEM_NOUSER))
@@ -552,17 +582,40 @@ nvc0_vspace_do_map_chunk(struct pscnv_vspace *vs, struct pscnv_chunk *cnk, uint6
 			pfl1 |= 0x2; /* NO SNOOP */
 		}
 		pfl1 |= 0x5;
+		
+		if ((cnk->flags & PSCNV_CHUNK_SYSRAM_LP) && vs->vid != -3 &&
+		    (bo->flags & PSCNV_GEM_MEMTYPE_MASK) == PSCNV_GEM_VRAM_LARGE &&
+		    !(offset & NVC0_LPAGE_MASK)) {
+			/* swapped chunk of a large page BO, all DMA segments
+			 * are aligned to large pages */
+			s = 0;
+			psh = NVC0_LPAGE_SHIFT;
+			pte = NVC0_LPTE(offset);
+		} else {
+			s = 1;
+			psh = NVC0_SPAGE_SHIFT;
+		}
+		psz = 1 << psh;
+		
 		spin_lock_irqsave(&nvc0_vs(vs)->pd_lock, flags);
-		for (i = 0; i < (pscnv_chunk_size(cnk) >> PAGE_SHIFT); ++i) {
-			uint64_t phys = cnk->pages[i].dma;
-			nv_wv32(pt->bo[1], pte * 8 + 4, pfl1);
-			nv_wv32(pt->bo[1], pte * 8 + 0, (phys >> 8) | pfl0);
-			pte++;
-			if ((pte & (NVC0_VM_BLOCK_MASK >> PAGE_SHIFT)) == 0) {
-				spin_unlock_irqrestore(&nvc0_vs(vs)->pd_lock, flags);
-				pte = 0;
-				pt = nvc0_vspace_pgt(vs, ++pde);
-				spin_lock_irqsave(&nvc0_vs(vs)->pd_lock, flags);
+		for_each_sg(cnk->sgt->sgl, sg, cnk->sgt->nents, i) {
+			uint64_t phys = sg_dma_address(sg);
+			int left = sg_dma_len(sg) >> psh;
+			
+			while (left) {
+				/* don't cross page table boundaries */
+				count = min(left, (int)((NVC0_VM_BLOCK_SIZE >> psh) - pte));
+				if (pt)
+					write_pt(pt->bo[s], pte, count, phys, psz, pfl0, pfl1);
+				phys += (uint64_t)count << psh;
+				pte += count;
+				left -= count;
+				if ((pte & (NVC0_VM_BLOCK_MASK >> psh)) == 0) {
+					spin_unlock_irqrestore(&nvc0_vs(vs)->pd_lock, flags);
+					pte = 0;
+					pt = nvc0_vspace_pgt_get(vs, ++pde, alloc);
+					spin_lock_irqsave(&nvc0_vs(vs)->pd_lock, flags);
+				}
 			}
 		}
 		spin_unlock_irqrestore(&nvc0_vs(vs)->pd_lock, flags);
@@ -592,17 +645,19 @@ nvc0_vspace_do_map_chunk(struct pscnv_vspace *vs, struct pscnv_chunk *cnk, uint6
 
 				pte = (offset & NVC0_VM_BLOCK_MASK) >> psh;
 				count = space >> psh;
-				pt = nvc0_vspace_pgt(vs, NVC0_PDE(offset));
+				pt = nvc0_vspace_pgt_get(vs, NVC0_PDE(offset), alloc);
 				
-				if (!pt) {
+				if (!pt && alloc) {
 					NV_ERROR(dev, "vspace_map: can't get pt %i[%llu]\n",
 						vs->vid, NVC0_PDE(offset));
 					return -ENOMEM;
 				}
 
-				spin_lock_irqsave(&nvc0_vs(vs)->pd_lock, flags);
-				write_pt(pt->bo[s], pte, count, phys, psz, pfl0, pfl1);
-				spin_unlock_irqrestore(&nvc0_vs(vs)->pd_lock, flags);
+				if (pt) {
+					spin_lock_irqsave(&nvc0_vs(vs)->pd_lock, flags);
+					write_pt(pt->bo[s], pte, count, phys, psz, pfl0, pfl1);
+					spin_unlock_irqrestore(&nvc0_vs(vs)->pd_lock, flags);
+				}
 
 				offset += space;
 				phys += space;
@@ -614,10 +669,35 @@ nvc0_vspace_do_map_chunk(struct pscnv_vspace *vs, struct pscnv_chunk *cnk, uint6
 			"cnk->alloc_type=%08x\n", bo->flags, cnk->alloc_type);
 		return -ENOSYS;
 	}
+	
+	return 0;
+}
+
+static int
+nvc0_vspace_do_map_chunk(struct pscnv_vspace *vs, struct pscnv_chunk *cnk, uint64_t offset)
+{
+	struct drm_nouveau_private *dev_priv = vs->dev->dev_private;
+	int ret;
+	
+	ret = nvc0_vspace_write_chunk_ptes(vs, cnk, offset, true);
+	
 	dev_priv->vm->bar_flush(vs->dev);
 	nvc0_tlb_flush(vs);
 	
-	return 0;
+	return ret;
+}
+
+/* replace the PTEs of a mapped chunk with the ones of cnk, which may live in
+ * a different kind of memory. Leaves flushing to the caller, so that many
+ * chunks or vspaces can be updated with a single flush. The page tables of
+ * the mapping exist already, so nothing gets allocated here */
+static int
+nvc0_vspace_do_remap_chunk(struct pscnv_vspace *vs, struct pscnv_chunk *cnk, uint64_t offset)
+{
+	/* large and small PTEs live in different page tables, clear both */
+	nvc0_vspace_clear_ptes(vs, offset, pscnv_chunk_size(cnk), false);
+	
+	return nvc0_vspace_write_chunk_ptes(vs, cnk, offset, false);
 }
 
 static int
@@ -632,10 +712,10 @@ nvc0_vspace_do_map(struct pscnv_vspace *vs, struct pscnv_bo *bo, uint64_t offset
 
 	for (i = 0; i < bo->n_chunks; i++) {
 		struct pscnv_chunk *cnk = &bo->chunks[i];
-		ret = nvc0_vspace_do_map_chunk(vs, cnk, last_offset);
+		ret = nvc0_vspace_write_chunk_ptes(vs, cnk, last_offset, true);
 		
 		if (ret) {
-			NV_ERROR(dev, "nvc0_vspace_do_map_chunk failed"
+			NV_ERROR(dev, "nvc0_vspace_write_chunk_ptes failed"
 				" on %08x/%d-%u in vs %d. ret=%d\n",
 				bo->cookie, bo->serial, cnk->idx, vs->vid, ret);
 			if (last_offset > offset) {
@@ -808,6 +888,8 @@ nvc0_vm_init(struct drm_device *dev) {
 	vme->base.do_map = nvc0_vspace_do_map;
 	vme->base.do_map_chunk = nvc0_vspace_do_map_chunk;
 	vme->base.do_unmap = nvc0_vspace_do_unmap;
+	vme->base.do_remap_chunk = nvc0_vspace_do_remap_chunk;
+	vme->base.tlb_flush = nvc0_tlb_flush;
 	vme->base.map_user = nvc0_vm_map_user;
 	vme->base.map_kernel = nvc0_vm_map_kernel;
 	vme->base.bar_flush = nv84_vm_bar_flush;
@@ -213,6 +213,156 @@ pscnv_chan_continue_stop_time(struct pscnv_chan *ch)
 }
 
 
+/* move the engine contexts back to VRAM. Called with evict_lock held */
+static void
+pscnv_chan_restore_unlocked(struct pscnv_chan *ch)
+{
+	struct drm_device *dev = ch->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int i;
+	
+	for (i = 0; i < PSCNV_ENGINES_NUM; i++) {
+		struct pscnv_engine *eng = dev_priv->engines[i];
+		
+		if (ch->engdata[i] && eng->chan_restore) {
+			/* on failure, the context stays usable in SYSRAM */
+			eng->chan_restore(eng, ch);
+		}
+	}
+	
+	ch->evicted = false;
+	
+	if (pscnv_pause_debug >= 1) {
+		NV_INFO(dev, "channel %d: restored engine contexts\n", ch->cid);
+	}
+}
+
+/* move the engine contexts to SYSRAM. Called with evict_lock held on a
+ * paused channel */
+static int
+pscnv_chan_evict_unlocked(struct pscnv_chan *ch)
+{
+	struct drm_device *dev = ch->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int i, ret;
+	
+	ch->evicted = true;
+	
+	for (i = 0; i < PSCNV_ENGINES_NUM; i++) {
+		struct pscnv_engine *eng = dev_priv->engines[i];
+		
+		if (!ch->engdata[i] || !eng->chan_evict) {
+			continue;
+		}
+		
+		ret = eng->chan_evict(eng, ch);
+		if (ret) {
+			NV_ERROR(dev, "channel %d: failed to evict "
+				"context of engine %d\n", ch->cid, i);
+			pscnv_chan_restore_unlocked(ch);
+			return ret;
+		}
+	}
+	
+	if (pscnv_pause_debug >= 1) {
+		NV_INFO(dev, "channel %d: evicted engine contexts\n", ch->cid);
+	}
+	
+	return 0;
+}
+
+void
+pscnv_chan_evict_idle(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_chan *ch;
+	unsigned long delay = (unsigned long)pscnv_swap_ctx_delay * HZ;
+	unsigned long flags;
+	bool idle, wake;
+	int cid, ret;
+	
+	if (!dev_priv->chan->read_ib_put) {
+		return;
+	}
+	
+	for (cid = dev_priv->chan->ch_min; cid <= dev_priv->chan->ch_max; cid++) {
+		spin_lock_irqsave(&dev_priv->chan->ch_lock, flags);
+		ch = dev_priv->chan->chans[cid];
+		if (ch) {
+			pscnv_chan_ref(ch);
+		}
+		spin_unlock_irqrestore(&dev_priv->chan->ch_lock, flags);
+		
+		if (!ch) {
+			continue;
+		}
+		
+		mutex_lock(&ch->evict_lock);
+		if (ch->idle_paused) {
+			/* while paused, the owner writes IB_PUT into the
+			 * shadow page. Any change means new work */
+			wake = dev_priv->chan->read_ib_put(ch) != ch->idle_ib_put;
+			if (wake) {
+				ch->idle_paused = false;
+			}
+			mutex_unlock(&ch->evict_lock);
+			
+			if (wake) {
+				if (pscnv_pause_debug >= 1) {
+					NV_INFO(dev, "channel %d: new work, "
+						"continuing\n", cid);
+				}
+				/* the client may have been parked while
+				 * all of its channels were idle */
+				pscnv_swapping_unpark_client(ch->client);
+				/* restores the engine contexts */
+				pscnv_chan_continue(ch);
+			}
+			goto next;
+		}
+		
+		idle = !ch->evicted && ch->client &&
+		       !(ch->flags & PSCNV_CHAN_KERNEL) &&
+		       pscnv_chan_get_state(ch) == PSCNV_CHAN_RUNNING &&
+		       time_after(jiffies, ch->last_active + delay) &&
+		       dev_priv->chan->read_ib_put(ch) == ch->last_ib_put;
+		mutex_unlock(&ch->evict_lock);
+		
+		if (!idle) {
+			goto next;
+		}
+		
+		/* the engines may only let go of the contexts after the GPU
+		 * finished all work of the channel, which pausing waits for */
+		ret = pscnv_chan_pause(ch);
+		if (ret && ret != -EALREADY) {
+			NV_ERROR(dev, "channel %d: failed to pause idle "
+				"channel, ret=%d\n", cid, ret);
+		}
+		ret = pscnv_chan_pause_wait(ch);
+		if (ret) {
+			NV_ERROR(dev, "channel %d: failed to wait for idle "
+				"channel, ret=%d\n", cid, ret);
+			pscnv_chan_continue(ch);
+			goto next;
+		}
+		
+		mutex_lock(&ch->evict_lock);
+		ret = ch->evicted ? -EALREADY : pscnv_chan_evict_unlocked(ch);
+		if (!ret) {
+			ch->idle_paused = true;
+			ch->idle_ib_put = dev_priv->chan->read_ib_put(ch);
+		}
+		mutex_unlock(&ch->evict_lock);
+		
+		if (ret) {
+			pscnv_chan_continue(ch);
+		}
+next:
+		pscnv_chan_unref(ch);
+	}
+}
+
 int
 pscnv_chan_continue(struct pscnv_chan *ch)
 {
@@ -227,9 +377,18 @@ pscnv_chan_continue(struct pscnv_chan *ch)
 		return -ENOSYS;
 	}
 	
+	/* the contexts have to be back in VRAM before the channel runs. As
+	 * long as other threads keep it paused, they may stay in SYSRAM.
+	 * pausing_threads only decreases under evict_lock */
+	mutex_lock(&ch->evict_lock);
+	if (ch->evicted && atomic_read(&ch->pausing_threads) <= 1) {
+		pscnv_chan_restore_unlocked(ch);
+	}
+	
 	spin_lock_irqsave(&ch->state_lock, flags);
 	if (ch->state != PSCNV_CHAN_PAUSED) {
 		spin_unlock_irqrestore(&ch->state_lock, flags);
+		mutex_unlock(&ch->evict_lock);
 		NV_ERROR(dev, "pscnv_chan_continue: channel %d is in unexpected "
 			"state %s\n", ch->cid, pscnv_chan_state_str(ch->state));
 		return -EINVAL;
@@ -252,6 +411,8 @@ pscnv_chan_continue(struct pscnv_chan *ch)
 		spin_unlock_irqrestore(&ch->state_lock, flags);
 	}
 	
+	mutex_unlock(&ch->evict_lock);
+	
 	if (res) {
 		NV_ERROR(dev, "do_chan_continue returned %d\n", res);
 		pscnv_chan_fail(ch);
@@ -336,6 +497,8 @@ pscnv_chan_new (struct drm_device *dev, struct pscnv_vspace *vs, int fake) {
 	}
 	spin_lock_init(&res->instlock);
 	spin_lock_init(&res->ramht.lock);
+	mutex_init(&res->evict_lock);
+	res->last_active = jiffies;
 	kref_init(&res->ref);
 	atomic_set(&res->pausing_threads, 0);
 	INIT_LIST_HEAD(&res->client_list);
@@ -394,7 +557,14 @@ void pscnv_chan_ref_free(struct kref *ref) {
 	
 	pscnv_debugfs_remove_chan(ch);
 	
-	list_del(&ch->client_list);
+	if (ch->client) {
+		/* see pscnv_client_pause_channels */
+		mutex_lock(&dev_priv->clients->lock);
+		list_del(&ch->client_list);
+		mutex_unlock(&dev_priv->clients->lock);
+	} else {
+		list_del(&ch->client_list);
+	}
 	
 	if (ch->cid >= 0) {
 		int i;
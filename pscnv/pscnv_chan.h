@@ -58,6 +58,18 @@ struct pscnv_chan {
 	atomic_t pausing_threads;
 	struct completion pause_completion;
 	s64 pause_start; /* getnstimeofday in ns for start of pause operation */
+	/* protects evicted, held while engine contexts move */
+	struct mutex evict_lock;
+	/* engine contexts have been moved to SYSRAM, see swap_ctx_delay */
+	bool evicted;
+	/* paused by pscnv_chan_evict_idle(), protected by evict_lock */
+	bool idle_paused;
+	/* IB_PUT when the channel was paused for being idle */
+	uint32_t idle_ib_put;
+	/* IB_PUT at the last activity sample of the swapping code */
+	uint32_t last_ib_put;
+	/* jiffies of the last sample that saw IB_PUT change */
+	unsigned long last_active;
 	/* pointer to the vma that remaps the fifo-regs for this channel */
 	struct vm_area_struct *vma;
 	struct pscnv_vspace *vspace;
@@ -96,6 +108,8 @@ struct pscnv_chan_engine {
 	int (*do_chan_pause) (struct pscnv_chan *ch);
 	/* when done, don't make any modification to the channel state */
 	int (*do_chan_continue) (struct pscnv_chan *ch);
+	/* optional: current IB_PUT of the channel, as written by its owner */
+	uint32_t (*read_ib_put) (struct pscnv_chan *ch);
 	struct pscnv_chan *fake_chans[4];
 	struct pscnv_chan *chans[128];
 	spinlock_t ch_lock;
@@ -167,6 +181,13 @@ pscnv_chan_pause_wait(struct pscnv_chan *ch);
 int
 pscnv_chan_continue(struct pscnv_chan *ch);
 
+/* pause all channels whose owner did not submit anything for more than
+ * swap_ctx_delay seconds and move their engine contexts to SYSRAM. Channels
+ * paused this way that got new work meanwhile are continued, which restores
+ * their contexts */
+void
+pscnv_chan_evict_idle(struct drm_device *dev);
+
 /*
  * some interrupts return an 'inst' code. This is the page frame number in
  * vspace of the ch->bo which caused the fault.
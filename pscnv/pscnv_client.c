@@ -2,6 +2,12 @@
 #include "pscnv_chan.h"
 
 #include <linux/kthread.h>
+#include <linux/eventfd.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+
+/* delay before the pause thread tries again to pause a client */
+#define PSCNV_PAUSE_RETRY_MS 100
 
 struct pscnv_client_work {
 	struct list_head entry;
@@ -13,44 +19,82 @@ struct pscnv_client_work {
    slab allocator here */
 static struct kmem_cache *client_work_cache = NULL;
 
-static void
-pscnv_client_pause_all_channels_of_client(struct pscnv_client *cl)
+int
+pscnv_client_pause_channels(struct pscnv_client *cl, struct pscnv_paused_chans *paused)
 {
 	struct drm_device *dev = cl->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_chan *ch;
+	int i, n = 0;
 	int res;
 	
+	paused->chans = NULL;
+	paused->n = 0;
+	
+	/* channels are added and removed under the clients lock, but pausing
+	 * may take long. So only collect them here */
+	mutex_lock(&dev_priv->clients->lock);
+	list_for_each_entry(ch, &cl->channels, client_list) {
+		n++;
+	}
+	if (n > 0) {
+		paused->chans = kmalloc(n * sizeof(struct pscnv_chan *), GFP_KERNEL);
+		if (!paused->chans) {
+			mutex_unlock(&dev_priv->clients->lock);
+			NV_ERROR(dev, "pscnv_client_pause_channels: out of memory\n");
+			return -ENOMEM;
+		}
+	}
 	list_for_each_entry(ch, &cl->channels, client_list) {
 		pscnv_chan_ref(ch);
+		paused->chans[paused->n++] = ch;
+	}
+	mutex_unlock(&dev_priv->clients->lock);
+	
+	for (i = 0; i < paused->n; i++) {
+		ch = paused->chans[i];
 		res = pscnv_chan_pause(ch);
 		if (res && res != -EALREADY) {
 			NV_ERROR(dev, "pscnv_chan_pause returned %d on "
 				"channel %d\n", res, ch->cid);	
 		}
 		res = pscnv_chan_pause_wait(ch);
-		if (res) {
+		if (res && pscnv_chan_get_state(ch) != PSCNV_CHAN_FAILED) {
+			/* a failed channel does not run anymore, but this
+			 * one may */
 			NV_ERROR(dev, "pscnv_chan_pause_wait returned %d"
 				" on channel %d\n", res, ch->cid);
+			/* the channels after this one were not paused */
+			while (paused->n > i + 1) {
+				pscnv_chan_unref(paused->chans[--paused->n]);
+			}
+			pscnv_client_continue_channels(paused);
+			return res;
 		}
 	}
+	
+	return 0;
 }
 
-static void
-pscnv_client_continue_all_channels_of_client(struct pscnv_client *cl)
+void
+pscnv_client_continue_channels(struct pscnv_paused_chans *paused)
 {
-	struct drm_device *dev = cl->dev;
 	struct pscnv_chan *ch;
-	int res;
+	int i, res;
 	
-	list_for_each_entry(ch, &cl->channels, client_list) {
+	for (i = 0; i < paused->n; i++) {
+		ch = paused->chans[i];
 		res = pscnv_chan_continue(ch);
 		if (res) {
-			NV_INFO(dev, "pscnv_chan_continue returned %d on "
+			NV_INFO(ch->dev, "pscnv_chan_continue returned %d on "
 				"channel %d\n", res, ch->cid);
 		}
 		pscnv_chan_unref(ch);
 	}
 	
+	kfree(paused->chans);
+	paused->chans = NULL;
+	paused->n = 0;
 }
 
 static int
@@ -62,6 +106,7 @@ pscnv_client_pause_thread(void *data)
 	
 	struct pscnv_client *cl;
 	struct pscnv_client *cl_to_pause = NULL;
+	struct pscnv_paused_chans paused;
 	
 	if (pscnv_pause_debug >= 2) {
 		NV_INFO(dev, "pscnv_client_pause_thread: init\n");
@@ -83,6 +128,8 @@ pscnv_client_pause_thread(void *data)
 		
 		mutex_lock(&clients->lock);
 		
+		/* on_empty_fifo is protected by cl->lock, but a racy look is
+		 * good enough here. The work itself is taken under the lock */
 		list_for_each_entry(cl, &clients->list, clients) {
 			if (list_empty(&cl->on_empty_fifo)) {
 				continue;
@@ -101,12 +148,20 @@ pscnv_client_pause_thread(void *data)
 			continue;
 		}
 		
-		/* TODO: proper error handling in case pausing fails */
-		pscnv_client_pause_all_channels_of_client(cl_to_pause);
+		if (pscnv_client_pause_channels(cl_to_pause, &paused)) {
+			/* the work may only run while none of the channels
+			 * does. Leave it queued and try again later */
+			NV_ERROR(dev, "pscnv_client_pause_thread: failed to pause "
+				"client %d, retrying\n", cl_to_pause->pid);
+			cl_to_pause = NULL;
+			msleep(PSCNV_PAUSE_RETRY_MS);
+			up(&clients->need_pause);
+			continue;
+		}
 		
 		pscnv_client_run_empty_fifo_work(cl_to_pause);
 		
-		pscnv_client_continue_all_channels_of_client(cl_to_pause);
+		pscnv_client_continue_channels(&paused);
 		
 		cl_to_pause = NULL;
 	}
@@ -130,6 +185,7 @@ pscnv_clients_init(struct drm_device *dev)
 {
 	struct pscnv_clients *clients;
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int node;
 
 	if (dev_priv->clients) {
 		NV_INFO(dev, "Clients: already initialized!\n");
@@ -146,7 +202,10 @@ pscnv_clients_init(struct drm_device *dev)
 	INIT_LIST_HEAD(&clients->list);
 	INIT_LIST_HEAD(&clients->list_dead);
 	INIT_LIST_HEAD(&clients->time_trackings);
+	INIT_LIST_HEAD(&clients->dirty);
 	mutex_init(&clients->lock);
+	spin_lock_init(&clients->dirty_lock);
+	clients->by_demand = RB_ROOT;
 	
 	if (!client_work_cache) {
 		client_work_cache = kmem_cache_create("pscnv_client_work",
@@ -161,7 +220,11 @@ pscnv_clients_init(struct drm_device *dev)
 	}
 	
 	sema_init(&clients->need_pause, 0);
-	clients->pause_thread = kthread_run(pscnv_client_pause_thread, dev, "pscnv_pause");
+	/* the pause thread does all the swapping DMA, keep it close to the
+	 * card and its SYSRAM */
+	node = dev_to_node(&dev->pdev->dev);
+	clients->pause_thread = kthread_create_on_node(pscnv_client_pause_thread,
+						dev, node, "pscnv_pause");
 	
 	if (IS_ERR_OR_NULL(clients->pause_thread)) {
 		NV_INFO(dev, "Clients: failed to start pause thread\n");
@@ -169,6 +232,11 @@ pscnv_clients_init(struct drm_device *dev)
 		return -ENOMEM;
 	}
 	
+	if (node != NUMA_NO_NODE) {
+		set_cpus_allowed_ptr(clients->pause_thread, cpumask_of_node(node));
+	}
+	wake_up_process(clients->pause_thread);
+	
 	dev_priv->clients = clients;
 	return 0;
 }
@@ -254,6 +322,32 @@ pscnv_client_search_pid(struct drm_device *dev, pid_t pid)
 	return cl;
 }
 
+/* sort cl into clients->by_demand, according to its current vram_demand.
+ * Clients with the same demand keep the order in which they were sorted in */
+static void
+pscnv_clients_insert_by_demand_unlocked(struct pscnv_clients *clients,
+					struct pscnv_client *cl)
+{
+	struct rb_node **pos = &clients->by_demand.rb_node;
+	struct rb_node *parent = NULL;
+	struct pscnv_client *cur;
+	
+	cl->demand_key = atomic64_read(&cl->vram_demand);
+	
+	while (*pos) {
+		parent = *pos;
+		cur = rb_entry(parent, struct pscnv_client, demand_node);
+		if (cl->demand_key < cur->demand_key) {
+			pos = &parent->rb_left;
+		} else {
+			pos = &parent->rb_right;
+		}
+	}
+	
+	rb_link_node(&cl->demand_node, parent, pos);
+	rb_insert_color(&cl->demand_node, &clients->by_demand);
+}
+
 static struct pscnv_client*
 pscnv_client_new_unlocked(struct drm_device *dev, pid_t pid, const char *comm)
 {
@@ -281,12 +375,16 @@ pscnv_client_new_unlocked(struct drm_device *dev, pid_t pid, const char *comm)
 	INIT_LIST_HEAD(&new->clients);
 	INIT_LIST_HEAD(&new->channels);
 	INIT_LIST_HEAD(&new->on_empty_fifo);
+	INIT_LIST_HEAD(&new->dirty_entry);
+	mutex_init(&new->lock);
 	pscnv_chunk_list_init(&new->swapping_options);
 	pscnv_chunk_list_init(&new->already_swapped);
 	pscnv_chunk_list_init(&new->swap_pending);
 	strncpy(new->comm, comm, TASK_COMM_LEN-1);
 	
 	list_add_tail(&new->clients, &dev_priv->clients->list);
+	pscnv_clients_insert_by_demand_unlocked(dev_priv->clients, new);
+	dev_priv->clients->n_clients++;
 	
 	BUG_ON(!pscnv_client_search_pid_unlocked(dev, pid));
 	
@@ -305,6 +403,19 @@ pscnv_client_free_unlocked(struct pscnv_client *cl)
 	/* remove from clients->list */
 	list_del_init(&cl->clients);
 	
+	spin_lock(&dev_priv->clients->dirty_lock);
+	list_del_init(&cl->dirty_entry);
+	spin_unlock(&dev_priv->clients->dirty_lock);
+	rb_erase(&cl->demand_node, &dev_priv->clients->by_demand);
+	
+	dev_priv->clients->n_clients--;
+	pscnv_client_set_resumed_unlocked(cl, false);
+	
+	/* the sums only cover living clients. Anything left here has already
+	 * been complained about in pscnv_client_ref_free */
+	atomic64_sub(atomic64_read(&cl->vram_usage), &dev_priv->clients->vram_usage);
+	atomic64_sub(atomic64_read(&cl->vram_swapped), &dev_priv->clients->vram_swapped);
+	atomic64_sub(atomic64_read(&cl->vram_demand), &dev_priv->clients->vram_demand);
 	
 	WARN_ON(!pscnv_chunk_list_empty(&cl->swapping_options));
 	pscnv_chunk_list_free(&cl->swapping_options);
@@ -313,11 +424,38 @@ pscnv_client_free_unlocked(struct pscnv_client *cl)
 	WARN_ON(!pscnv_chunk_list_empty(&cl->swap_pending));
 	pscnv_chunk_list_free(&cl->swap_pending);
 	
+	if (cl->pressure_eventfd) {
+		eventfd_ctx_put(cl->pressure_eventfd);
+		cl->pressure_eventfd = NULL;
+	}
+	
 	/* keep the client data structure around, so we can read its time trackings */
 	list_add_tail(&cl->clients, &dev_priv->clients->list_dead);
 }
 	
 
+/* takes the pages of a closed client back out of pinned_vm, when mmap_sem
+ * could not be taken right away */
+struct pscnv_client_unpin {
+	struct work_struct work;
+	struct mm_struct *mm;
+	unsigned long pages;
+};
+
+static void
+pscnv_client_unpin_work_func(struct work_struct *work)
+{
+	struct pscnv_client_unpin *unpin =
+		container_of(work, struct pscnv_client_unpin, work);
+	
+	down_write(&unpin->mm->mmap_sem);
+	unpin->mm->pinned_vm -= unpin->pages;
+	up_write(&unpin->mm->mmap_sem);
+	
+	mmdrop(unpin->mm);
+	kfree(unpin);
+}
+
 /* remove the client from the clients list and free memory */
 void
 pscnv_client_ref_free(struct kref *ref)
@@ -325,11 +463,14 @@ pscnv_client_ref_free(struct kref *ref)
 	struct pscnv_client *cl = container_of(ref, struct pscnv_client, ref);
 	struct drm_device *dev = cl->dev;
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_client_unpin *unpin;
 	char size_str[16];
 	
 	uint64_t vram_usage = atomic64_read(&cl->vram_usage);
 	uint64_t vram_swapped = atomic64_read(&cl->vram_swapped);
 	uint64_t vram_demand = atomic64_read(&cl->vram_demand);
+	
+	WARN_ON(atomic64_read(&cl->sysram_reserved) != 0);
 
 	pscnv_mem_human_readable(size_str, cl->vram_max);
 	NV_INFO(dev, "closing client %s:%d (vram_max=%s)\n",
@@ -341,23 +482,46 @@ pscnv_client_ref_free(struct kref *ref)
 			cl->comm, cl->pid, vram_usage, vram_swapped, vram_demand);
 	}
 	
+	if (cl->mm) {
+		if (cl->pinned_reported && down_write_trylock(&cl->mm->mmap_sem)) {
+			cl->mm->pinned_vm -= cl->pinned_reported;
+			cl->pinned_reported = 0;
+			up_write(&cl->mm->mmap_sem);
+		}
+		if (cl->pinned_reported) {
+			/* we may be called from munmap with mmap_sem already
+			 * held. The work takes over our mm_struct reference */
+			unpin = kmalloc(sizeof(struct pscnv_client_unpin), GFP_KERNEL);
+			if (unpin) {
+				INIT_WORK(&unpin->work, pscnv_client_unpin_work_func);
+				unpin->mm = cl->mm;
+				unpin->pages = cl->pinned_reported;
+				queue_work(dev_priv->wq, &unpin->work);
+				cl->mm = NULL;
+			} else {
+				NV_ERROR(dev, "client %s:%d: out of memory, "
+					"leaking %lu pages of pinned_vm\n",
+					cl->comm, cl->pid, cl->pinned_reported);
+			}
+			cl->pinned_reported = 0;
+		}
+		if (cl->mm) {
+			mmdrop(cl->mm);
+			cl->mm = NULL;
+		}
+	}
+	
 	mutex_lock(&dev_priv->clients->lock);
 	pscnv_client_free_unlocked(cl);
 	mutex_unlock(&dev_priv->clients->lock);
 }
 
-int
-pscnv_client_open(struct drm_device *dev, struct drm_file *file_priv)
+struct pscnv_client*
+pscnv_client_get(struct drm_device *dev, struct task_struct *task)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_client *cl;
-	const pid_t pid = file_priv->pid;
-	struct task_struct *task = pid_task(find_vpid(pid), PIDTYPE_PID);
-	
-	if (!task) {
-		NV_ERROR(dev, "pscnv_client_new: no process for pid %d\n", pid);
-		return 0;
-	}
+	const pid_t pid = task_pid_nr(task);
 	
 	mutex_lock(&dev_priv->clients->lock);
 	
@@ -367,10 +531,34 @@ pscnv_client_open(struct drm_device *dev, struct drm_file *file_priv)
 	} else {
 		NV_INFO(dev, "new client %s:%d\n", task->comm, pid);
 		cl = pscnv_client_new_unlocked(dev, pid, task->comm);
+		if (cl) {
+			cl->mm = get_task_mm(task);
+			if (cl->mm) {
+				/* only keep the mm_struct, not the address space */
+				atomic_inc(&cl->mm->mm_count);
+				mmput(cl->mm);
+			}
+		}
 	}
 	
 	mutex_unlock(&dev_priv->clients->lock);
 	
+	return cl;
+}
+
+int
+pscnv_client_open(struct drm_device *dev, struct drm_file *file_priv)
+{
+	struct pscnv_client *cl;
+	const pid_t pid = file_priv->pid;
+	struct task_struct *task = pid_task(find_vpid(pid), PIDTYPE_PID);
+	
+	if (!task) {
+		NV_ERROR(dev, "pscnv_client_new: no process for pid %d\n", pid);
+		return 0;
+	}
+	
+	cl = pscnv_client_get(dev, task);
 	if (!cl) {
 		NV_ERROR(dev, "pscnv_client_open: failed for pid %d\n", pid);
 		return -EINVAL;
@@ -424,11 +612,9 @@ pscnv_client_do_on_empty_fifo_unlocked(struct pscnv_client *cl, client_workfunc_
 void
 pscnv_client_run_empty_fifo_work(struct pscnv_client *cl)
 {
-	struct drm_device *dev = cl->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_client_work *work;
 	
-	mutex_lock(&dev_priv->clients->lock);
+	mutex_lock(&cl->lock);
 	while (!list_empty(&cl->on_empty_fifo)) {
 		/* the work in the queue meight take some time, so we always
 		   pick just one element and then release the lock again.
@@ -438,46 +624,129 @@ pscnv_client_run_empty_fifo_work(struct pscnv_client *cl)
 		/* use del_init here, so that the work may be safely  reused */
 		list_del_init(&work->entry);
 		
-		mutex_unlock(&dev_priv->clients->lock);
+		mutex_unlock(&cl->lock);
 		
 		/* release lock here, because this may take some time */
 		work->func(work->data, cl);
 		kmem_cache_free(client_work_cache, work);
 		
-		mutex_lock(&dev_priv->clients->lock);
+		mutex_lock(&cl->lock);
 	} /* ^^ list_empty checked again */
 	
-	mutex_unlock(&dev_priv->clients->lock);
+	mutex_unlock(&cl->lock);
 }
 
-uint64_t
-pscnv_clients_vram_common_unlocked(struct drm_device *dev, size_t offset)
+void
+pscnv_client_demand_add(struct pscnv_client *cl, int64_t delta)
+{
+	struct drm_nouveau_private *dev_priv = cl->dev->dev_private;
+	struct pscnv_clients *clients = dev_priv->clients;
+	
+	atomic64_add(delta, &cl->vram_demand);
+	atomic64_add(delta, &clients->vram_demand);
+	
+	spin_lock(&clients->dirty_lock);
+	if (list_empty(&cl->dirty_entry)) {
+		list_add_tail(&cl->dirty_entry, &clients->dirty);
+	}
+	spin_unlock(&clients->dirty_lock);
+}
+
+void
+pscnv_clients_sort_unlocked(struct drm_device *dev)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_clients *clients = dev_priv->clients;
-	struct pscnv_client *cur;
+	struct pscnv_client *cl;
+	
+	BUG_ON(!mutex_is_locked(&clients->lock));
 	
-	uint64_t sum = 0;
+	/* demand_key is read after the client left the dirty list, so any
+	 * later change puts it back there */
+	spin_lock(&clients->dirty_lock);
+	while (!list_empty(&clients->dirty)) {
+		cl = list_first_entry(&clients->dirty, struct pscnv_client, dirty_entry);
+		list_del_init(&cl->dirty_entry);
+		
+		rb_erase(&cl->demand_node, &clients->by_demand);
+		pscnv_clients_insert_by_demand_unlocked(clients, cl);
+	}
+	spin_unlock(&clients->dirty_lock);
+}
+
+void
+pscnv_client_set_resumed_unlocked(struct pscnv_client *cl, bool resumed)
+{
+	struct drm_nouveau_private *dev_priv = cl->dev->dev_private;
 	
-	list_for_each_entry(cur, &clients->list, clients) {
-		sum += atomic64_read((atomic64_t*)((char*)cur + offset));
+	if (cl->resumed == resumed) {
+		return;
 	}
 	
-	return sum;
+	cl->resumed = resumed;
+	dev_priv->clients->n_resumed += resumed ? 1 : -1;
 }
 
-uint64_t
-pscnv_clients_vram_common(struct drm_device *dev, size_t offset)
+int
+pscnv_client_pressure_notify(struct pscnv_client *cl, int fd, uint32_t mask, uint32_t *events)
 {
+	struct drm_device *dev = cl->dev;
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	struct pscnv_clients *clients = dev_priv->clients;
-	uint64_t res;
+	struct eventfd_ctx *ctx = NULL;
+	struct eventfd_ctx *old_ctx = NULL;
+	
+	if (fd >= 0) {
+		ctx = eventfd_ctx_fdget(fd);
+		if (IS_ERR(ctx)) {
+			return PTR_ERR(ctx);
+		}
+	} else if (fd != -1 && fd != PSCNV_PRESSURE_FD_KEEP) {
+		return -EINVAL;
+	}
+	
+	mutex_lock(&dev_priv->clients->lock);
+	
+	if (fd != PSCNV_PRESSURE_FD_KEEP) {
+		old_ctx = cl->pressure_eventfd;
+		cl->pressure_eventfd = ctx;
+		cl->pressure_mask = (ctx) ? mask : 0;
+		/* 0 = unknown, the next check will fill it in */
+		cl->pressure_share = 0;
+	}
+	
+	*events = (uint32_t) xchg(&cl->pressure_events, 0);
 	
-	mutex_lock(&clients->lock);
-	res = pscnv_clients_vram_common_unlocked(dev, offset);
 	mutex_unlock(&dev_priv->clients->lock);
 	
-	return res;
+	if (old_ctx) {
+		eventfd_ctx_put(old_ctx);
+	}
+	
+	if (pscnv_swapping_debug >= 2) {
+		NV_INFO(dev, "pscnv_client_pressure_notify: client %d fd=%d "
+			"mask=%x events=%x\n", cl->pid, fd, mask, *events);
+	}
+	
+	return 0;
+}
+
+void
+pscnv_client_pressure_event_unlocked(struct pscnv_client *cl, uint32_t event)
+{
+	struct drm_device *dev = cl->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	
+	BUG_ON(!mutex_is_locked(&dev_priv->clients->lock));
+	
+	set_bit(__ffs(event), &cl->pressure_events);
+	
+	if (cl->pressure_eventfd && (cl->pressure_mask & event)) {
+		if (pscnv_swapping_debug >= 2) {
+			NV_INFO(dev, "pscnv_client_pressure_event: signal "
+				"event %x to client %d\n", event, cl->pid);
+		}
+		eventfd_signal(cl->pressure_eventfd, 1);
+	}
 }
 
 /* safe for cl == NULL */
@@ -509,3 +778,73 @@ pscnv_client_track_time(struct pscnv_client *cl, s64 start, s64 duration, u64 by
 	tt->bytes = bytes;
 	list_add_tail(&tt->list, &dev_priv->clients->time_trackings);
 }
+
+/* charge the pinned SYSRAM of cl to pinned_vm of its process, where it shows
+ * up as VmPin. Must be called without mmap_sem and clients->lock held */
+static void
+pscnv_client_update_pinned(struct pscnv_client *cl)
+{
+	struct mm_struct *mm = cl->mm;
+	unsigned long pages = atomic64_read(&cl->sysram_pages);
+	
+	if (!mm || pages == cl->pinned_reported) {
+		return;
+	}
+	
+	/* sysram chunks are freed from munmap with mmap_sem held, they are
+	 * only counted here to stay out of its way. Retry next time */
+	if (!down_write_trylock(&mm->mmap_sem)) {
+		return;
+	}
+	mm->pinned_vm += pages - cl->pinned_reported;
+	up_write(&mm->mmap_sem);
+	
+	cl->pinned_reported = pages;
+}
+
+void
+pscnv_clients_update_pinned(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_client *cur, **cls;
+	int n = 0, max = 0;
+	int i;
+	
+	mutex_lock(&dev_priv->clients->lock);
+	list_for_each_entry(cur, &dev_priv->clients->list, clients) {
+		max++;
+	}
+	cls = kmalloc(max * sizeof(struct pscnv_client *), GFP_KERNEL);
+	if (cls) {
+		list_for_each_entry(cur, &dev_priv->clients->list, clients) {
+			if (cur->mm) {
+				pscnv_client_ref(cur);
+				cls[n++] = cur;
+			}
+		}
+	}
+	mutex_unlock(&dev_priv->clients->lock);
+	
+	for (i = 0; i < n; i++) {
+		pscnv_client_update_pinned(cls[i]);
+		pscnv_client_unref(cls[i]);
+	}
+	
+	kfree(cls);
+}
+
+bool
+pscnv_client_host_quota_ok(struct pscnv_client *cl, uint64_t size)
+{
+	uint64_t limit = (uint64_t)pscnv_swap_client_limit << 20;
+	uint64_t used;
+	
+	if (!cl || limit == 0) {
+		return true;
+	}
+	
+	used = (uint64_t)atomic64_read(&cl->sysram_pages) << PAGE_SHIFT;
+	used += atomic64_read(&cl->sysram_reserved);
+	
+	return used + size <= limit;
+}
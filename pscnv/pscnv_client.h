@@ -4,6 +4,8 @@
 #include "nouveau_drv.h"
 #include "pscnv_swapping.h"
 
+#include <linux/rbtree.h>
+
 struct pscnv_client_timetrack {
 	struct list_head list;
 	struct pscnv_client *client;
@@ -24,7 +26,16 @@ struct pscnv_clients {
 	/* list of dead clients */
 	struct list_head list_dead;
 	
-	/* lock on all clients */
+	/* protects list, list_dead and time_trackings, the channels, pressure
+	 * state and activity flags of every client, and all decisions that
+	 * involve more than one client, like choosing a victim for swapping.
+	 *
+	 * Lock ordering: clients->lock, then pscnv_client.lock, then
+	 * bo->maps_lock and vram_mutex. Never hold the locks of two clients
+	 * at once, and never take clients->lock while holding the lock of a
+	 * client. Things that concern a single client, like adding or
+	 * freeing its BOs or running its swaptasks, only take its own lock,
+	 * so they do not get in the way of other clients */
 	struct mutex lock;
 	
 	/* thread that pauses channels and performs the empty fifo work */
@@ -38,6 +49,28 @@ struct pscnv_clients {
 	
 	/* list of times that have been tracked */
 	struct list_head time_trackings;
+	
+	/* sums of the vram counters of all living clients, updated along with
+	 * the counters of each client by pscnv_client_{usage,swapped,demand}_add,
+	 * so nobody has to walk the list to read them */
+	atomic64_t vram_usage;
+	atomic64_t vram_swapped;
+	atomic64_t vram_demand;
+	
+	/* living clients, sorted by pscnv_client.demand_key. Protected by lock */
+	struct rb_root by_demand;
+	
+	/* clients whose vram_demand changed since they were sorted into
+	 * by_demand. They get sorted again, before anybody looks at by_demand.
+	 * Protected by dirty_lock, which may be taken with spinlocks held */
+	struct list_head dirty;
+	spinlock_t dirty_lock;
+	
+	/* number of living clients, protected by lock */
+	int n_clients;
+	
+	/* number of living clients with resumed set, protected by lock */
+	int n_resumed;
 };
 
 /* instance per pid */
@@ -60,9 +93,23 @@ struct pscnv_client {
 	/* list the client is in, see pscnv_clients.list */
 	struct list_head clients;
 	
+	/* position in pscnv_clients.by_demand and the vram_demand it has been
+	 * sorted by */
+	struct rb_node demand_node;
+	uint64_t demand_key;
+	
+	/* entry in pscnv_clients.dirty, empty if demand_key is up to date */
+	struct list_head dirty_entry;
+	
 	/* list of all channels held by this client */
 	struct list_head channels;
 	
+	/* protects the three chunk lists below, the list and swaptask fields
+	 * of their chunks, the swaptasks of this client and on_empty_fifo.
+	 * Others may read the sizes of the lists without it, as a hint. See
+	 * pscnv_clients.lock for the lock ordering */
+	struct mutex lock;
+	
 	/* list of chunks that meight be taken away from this client */
 	struct pscnv_chunk_list swapping_options;
 	
@@ -72,11 +119,56 @@ struct pscnv_client {
 	/* list of chunks that are passing between one of the other two lists */
 	struct pscnv_chunk_list swap_pending;
 	
+	/* number of chunks in swap_pending that are moved into or out of the
+	 * swapstore */
+	atomic_t parking;
+	
 	/* list of work to do, next time that this client has an empty fifo */
 	struct list_head on_empty_fifo;
 	
 	/* readable (process) name of this client */
 	char comm[TASK_COMM_LEN];
+	
+	/* eventfd that is signaled on memory pressure, or NULL */
+	struct eventfd_ctx *pressure_eventfd;
+	
+	/* PSCNV_PRESSURE_* events that signal pressure_eventfd */
+	uint32_t pressure_mask;
+	
+	/* bitmask of PSCNV_PRESSURE_* events that happened since the client
+	 * asked last time */
+	unsigned long pressure_events;
+	
+	/* vram_share at the last check, used to detect a shrinking share */
+	uint64_t pressure_share;
+	
+	/* address space of the client process, may be NULL */
+	struct mm_struct *mm;
+	
+	/* pinned pages of all SYSRAM chunks of this client, swapped or not */
+	atomic64_t sysram_pages;
+	
+	/* bytes of SYSRAM that chunks which are queued for swap-out will need.
+	 * Counts against swap_client_limit along with sysram_pages. Only
+	 * changed with lock held */
+	atomic64_t sysram_reserved;
+	
+	/* pages of sysram_pages that have been added to mm->pinned_vm */
+	unsigned long pinned_reported;
+	
+	/* true, if one of the channels submitted work since the previous
+	 * activity sample */
+	bool submitting;
+	
+	/* client started submitting again while it had swapped chunks, it
+	 * will be the next one to get its chunks back. Only to be changed by
+	 * pscnv_client_set_resumed_unlocked */
+	bool resumed;
+	
+	/* pscnv_swapping.swapin_run of the last increase_vram run in which no
+	 * chunk of this client could be swapped in. It is not picked as a
+	 * winner again during that run. Protected by clients->lock */
+	unsigned int swapin_skip_run;
 };
 
 typedef void (*client_workfunc_t)(void *data, struct pscnv_client *cl);
@@ -109,6 +201,25 @@ pscnv_client_unref(struct pscnv_client *cl) {
 struct pscnv_client*
 pscnv_client_search_pid(struct drm_device *dev, pid_t pid);
 
+/* get a reference to the client instance of task, which is created if the
+ * process does not have one, yet. Returns NULL on failure */
+struct pscnv_client*
+pscnv_client_get(struct drm_device *dev, struct task_struct *task);
+
+/* pause all channels of cl and wait until they are idle. The channels are
+ * recorded in paused, each with a reference, so that exactly these get
+ * continued again, even if cl creates new channels in the meantime. Only to
+ * be called on the pause thread, e.g. from within on_empty_fifo work.
+ *
+ * Returns an error if not all channels could be paused. Nothing is paused
+ * anymore in that case */
+int
+pscnv_client_pause_channels(struct pscnv_client *cl, struct pscnv_paused_chans *paused);
+
+/* let the channels in paused run again after the above */
+void
+pscnv_client_continue_channels(struct pscnv_paused_chans *paused);
+
 /* called every time some application opens a drm device */
 int
 pscnv_client_open(struct drm_device *dev, struct drm_file *file_priv);
@@ -119,54 +230,92 @@ pscnv_client_open(struct drm_device *dev, struct drm_file *file_priv);
 void
 pscnv_client_postclose(struct drm_device *dev, struct drm_file *file_priv);
 
+/* queue work for the pause thread. Called with cl->lock held */
 void
 pscnv_client_do_on_empty_fifo_unlocked(struct pscnv_client *cl, client_workfunc_t func, void *data);
 
 void
 pscnv_client_run_empty_fifo_work(struct pscnv_client *cl);
 
-uint64_t
-pscnv_clients_vram_common_unlocked(struct drm_device *dev, size_t offset);
-
-uint64_t
-pscnv_clients_vram_common(struct drm_device *dev, size_t offset);
-
-static inline uint64_t
-pscnv_clients_vram_usage_unlocked(struct drm_device *dev)
+/* change vram_usage of cl and the sum over all clients */
+static inline void
+pscnv_client_usage_add(struct pscnv_client *cl, int64_t delta)
 {
-	return pscnv_clients_vram_common_unlocked(dev, offsetof(struct pscnv_client, vram_usage));
+	struct drm_nouveau_private *dev_priv = cl->dev->dev_private;
+	
+	atomic64_add(delta, &cl->vram_usage);
+	atomic64_add(delta, &dev_priv->clients->vram_usage);
 }
 
-static inline uint64_t
-pscnv_clients_vram_usage(struct drm_device *dev)
+/* change vram_swapped of cl and the sum over all clients */
+static inline void
+pscnv_client_swapped_add(struct pscnv_client *cl, int64_t delta)
 {
-	return pscnv_clients_vram_common(dev, offsetof(struct pscnv_client, vram_usage));
+	struct drm_nouveau_private *dev_priv = cl->dev->dev_private;
+	
+	atomic64_add(delta, &cl->vram_swapped);
+	atomic64_add(delta, &dev_priv->clients->vram_swapped);
 }
 
-static inline uint64_t
-pscnv_clients_vram_swapped_unlocked(struct drm_device *dev)
-{
-	return pscnv_clients_vram_common_unlocked(dev, offsetof(struct pscnv_client, vram_swapped));
-}
+/* change vram_demand of cl and the sum over all clients, cl gets sorted into
+ * pscnv_clients.by_demand again on the next use. May be called with spinlocks
+ * held */
+void
+pscnv_client_demand_add(struct pscnv_client *cl, int64_t delta);
+
+/* bring pscnv_clients.by_demand up to date. Called with clients->lock held */
+void
+pscnv_clients_sort_unlocked(struct drm_device *dev);
+
+/* change cl->resumed and keep count of it. Called with clients->lock held */
+void
+pscnv_client_set_resumed_unlocked(struct pscnv_client *cl, bool resumed);
 
 static inline uint64_t
-pscnv_clients_vram_swapped(struct drm_device *dev)
+pscnv_clients_vram_usage(struct drm_device *dev)
 {
-	return pscnv_clients_vram_common(dev, offsetof(struct pscnv_client, vram_swapped));
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	
+	return atomic64_read(&dev_priv->clients->vram_usage);
 }
 
 static inline uint64_t
-pscnv_clients_vram_demand_unlocked(struct drm_device *dev)
+pscnv_clients_vram_swapped(struct drm_device *dev)
 {
-	return pscnv_clients_vram_common_unlocked(dev, offsetof(struct pscnv_client, vram_demand));
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	
+	return atomic64_read(&dev_priv->clients->vram_swapped);
 }
 
 static inline uint64_t
 pscnv_clients_vram_demand(struct drm_device *dev)
 {
-	return pscnv_clients_vram_common(dev, offsetof(struct pscnv_client, vram_demand));
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	
+	return atomic64_read(&dev_priv->clients->vram_demand);
 }
 
+/* register (fd >= 0) or unregister (fd == -1) an eventfd for memory pressure
+ * events and return the events that happened in the meantime */
+int
+pscnv_client_pressure_notify(struct pscnv_client *cl, int fd, uint32_t mask, uint32_t *events);
+
+/* remember that some PSCNV_PRESSURE_* event happened and signal the eventfd,
+ * if the client is interested. Called with clients->lock held */
+void
+pscnv_client_pressure_event_unlocked(struct pscnv_client *cl, uint32_t event);
+
+/* report the pinned SYSRAM of all clients to Linux, see
+ * pscnv_client.sysram_pages */
+void
+pscnv_clients_update_pinned(struct drm_device *dev);
+
+/* returns true, if cl (may be NULL) may get another size bytes of SYSRAM,
+ * swapped or not, without exceeding swap_client_limit. SYSRAM that has been
+ * reserved for queued swap-outs counts as used */
+bool
+pscnv_client_host_quota_ok(struct pscnv_client *cl, uint64_t size);
+
 /* safe for cl == NULL */
 void
 pscnv_client_track_time(struct pscnv_client *cl, s64 start, s64 duration, u64 bytes, const char *name);
@@ -145,6 +145,74 @@ struct drm_pscnv_obj_eng_new {
 	uint32_t flags;		/* < */
 };
 
+/* for gem_residency */
+struct drm_pscnv_gem_residency {
+	/* GEM handle of the BO */
+	uint32_t handle;	/* < */
+	/* capacity of the residency array in chunks (in), number of chunks
+	 * of the BO (out) */
+	uint32_t n_chunks;	/* < > */
+	/* user pointer to an array of (n_chunks + 3) / 4 bytes that receives
+	 * 2 bits per chunk, see PSCNV_RESIDENCY_*. Chunk i is found at bits
+	 * 2*(i%4) of byte i/4. May be 0 to only query the sums */
+	uint64_t residency;	/* < */
+	/* size of all chunks but the last one */
+	uint64_t chunk_size;	/* > */
+	/* bytes of the BO that are in VRAM */
+	uint64_t vram_bytes;	/* > */
+	/* bytes of the BO that are in SYSRAM, as requested by userspace */
+	uint64_t sysram_bytes;	/* > */
+	/* bytes of the BO that have been swapped out to SYSRAM */
+	uint64_t swapped_bytes;	/* > */
+};
+#define PSCNV_RESIDENCY_UNALLOCATED	0
+#define PSCNV_RESIDENCY_VRAM		1
+#define PSCNV_RESIDENCY_SYSRAM		2
+#define PSCNV_RESIDENCY_SWAPPED		3
+
+/* for gem_advise */
+struct drm_pscnv_gem_advise {
+	/* GEM handle of the BO */
+	uint32_t handle;	/* < */
+	/* expected use of the BO, see PSCNV_ADVICE_* */
+	uint32_t advice;	/* < */
+};
+#define PSCNV_ADVICE_NORMAL		0	/* no special treatment */
+#define PSCNV_ADVICE_WILLNEED		1	/* swap in before other BOs */
+#define PSCNV_ADVICE_DONTNEED		2	/* swap in after other BOs */
+
+/* for vram_budget */
+struct drm_pscnv_vram_budget {
+	/* VRAM currently allocated by the calling client */
+	uint64_t vram_usage;	/* > */
+	/* memory of the calling client that has been moved to SYSRAM */
+	uint64_t vram_swapped;	/* > */
+	/* VRAM that the calling client would like to have */
+	uint64_t vram_demand;	/* > */
+	/* VRAM that the calling client may use without being chosen as
+	 * swapping victim */
+	uint64_t vram_share;	/* > */
+	/* VRAM that is neither used nor demanded by any client */
+	uint64_t vram_free;	/* > */
+};
+
+/* for pressure_notify */
+struct drm_pscnv_pressure_notify {
+	/* eventfd that gets signaled on memory pressure events. Use -1 to
+	 * unregister and PSCNV_PRESSURE_FD_KEEP to just read the events */
+	int32_t fd;		/* < */
+	/* events that shall signal the eventfd, see below */
+	uint32_t mask;		/* < */
+	/* events that happened since the last call, cleared by this call */
+	uint32_t events;	/* > */
+	uint32_t _pad;
+};
+#define PSCNV_PRESSURE_SHARE_SHRINK	0x00000001	/* vram_share of the client got smaller */
+#define PSCNV_PRESSURE_EVICT		0x00000002	/* chunks of the client get swapped out */
+#define PSCNV_PRESSURE_HEADROOM		0x00000004	/* unused VRAM is available again */
+#define PSCNV_PRESSURE_ALL		0x00000007
+#define PSCNV_PRESSURE_FD_KEEP		(-2)
+
 #define DRM_PSCNV_GETPARAM           0x00	/* get some information from the card */
 #define DRM_PSCNV_GEM_NEW            0x20	/* create a new BO */
 #define DRM_PSCNV_GEM_INFO           0x21	/* get info about a BO */
@@ -161,6 +229,10 @@ struct drm_pscnv_obj_eng_new {
 #define DRM_PSCNV_FIFO_INIT_IB       0x2b	/* Initialises IB PFIFO processing on a channel */
 /*#define DRM_PSCNV_FIFO_RESUME_IB   0x2c	   Initialises IB PFIFO processing on a channel
                                                without initializing the control region */
+#define DRM_PSCNV_VRAM_BUDGET        0x2d	/* get VRAM usage and share of the calling process */
+#define DRM_PSCNV_PRESSURE_NOTIFY    0x2e	/* register an eventfd for memory pressure events */
+#define DRM_PSCNV_GEM_RESIDENCY      0x2f	/* find out where the chunks of a BO are */
+#define DRM_PSCNV_GEM_ADVISE         0x30	/* tell how a BO will be used */
 #define DRM_PSCNV_COPY_TO_HOST       0x3a       /* copy a buffer object to host memory */
 
 #define DRM_IOCTL_PSCNV_GETPARAM           DRM_IOWR(DRM_COMMAND_BASE + DRM_PSCNV_GETPARAM, struct drm_pscnv_getparam)
@@ -177,6 +249,10 @@ struct drm_pscnv_obj_eng_new {
 #define DRM_IOCTL_PSCNV_FIFO_INIT          DRM_IOW(DRM_COMMAND_BASE + DRM_PSCNV_FIFO_INIT, struct drm_pscnv_fifo_init)
 #define DRM_IOCTL_PSCNV_OBJ_ENG_NEW        DRM_IOW(DRM_COMMAND_BASE + DRM_PSCNV_OBJ_ENG_NEW, struct drm_pscnv_obj_eng_new)
 #define DRM_IOCTL_PSCNV_FIFO_INIT_IB       DRM_IOW(DRM_COMMAND_BASE + DRM_PSCNV_FIFO_INIT_IB, struct drm_pscnv_fifo_init_ib)
+#define DRM_IOCTL_PSCNV_VRAM_BUDGET        DRM_IOWR(DRM_COMMAND_BASE + DRM_PSCNV_VRAM_BUDGET, struct drm_pscnv_vram_budget)
+#define DRM_IOCTL_PSCNV_PRESSURE_NOTIFY    DRM_IOWR(DRM_COMMAND_BASE + DRM_PSCNV_PRESSURE_NOTIFY, struct drm_pscnv_pressure_notify)
+#define DRM_IOCTL_PSCNV_GEM_RESIDENCY      DRM_IOWR(DRM_COMMAND_BASE + DRM_PSCNV_GEM_RESIDENCY, struct drm_pscnv_gem_residency)
+#define DRM_IOCTL_PSCNV_GEM_ADVISE         DRM_IOW(DRM_COMMAND_BASE + DRM_PSCNV_GEM_ADVISE, struct drm_pscnv_gem_advise)
 #define DRM_IOCTL_PSCNV_COPY_TO_HOST       DRM_IOW(DRM_COMMAND_BASE + DRM_PSCNV_COPY_TO_HOST, struct drm_pscnv_gem_info)
 
 #endif /* __PSCNV_DRM_H__ */
@@ -13,6 +13,9 @@ struct pscnv_engine {
 	void (*chan_free) (struct pscnv_engine *eng, struct pscnv_chan *ch);
 	int (*chan_obj_new) (struct pscnv_engine *eng, struct pscnv_chan *ch, uint32_t handle, uint32_t oclass, uint32_t flags);
 	void (*chan_kill) (struct pscnv_engine *eng, struct pscnv_chan *ch);
+	/* optional: move the context of a paused channel out of VRAM and back */
+	int (*chan_evict) (struct pscnv_engine *eng, struct pscnv_chan *ch);
+	int (*chan_restore) (struct pscnv_engine *eng, struct pscnv_chan *ch);
 };
 
 int nv50_graph_init(struct drm_device *dev);
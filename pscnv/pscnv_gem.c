@@ -29,6 +29,7 @@
 #include "pscnv_gem.h"
 #include "pscnv_mem.h"
 #include "pscnv_drm.h"
+#include "pscnv_client.h"
 
 void pscnv_gem_free_object (struct drm_gem_object *obj) {
 	struct drm_device *dev = obj->dev;
@@ -67,10 +68,31 @@ void pscnv_gem_free_object (struct drm_gem_object *obj) {
 	pscnv_bo_unref(vo);
 }
 
+/* a BO that is imported by another process (flink/open or prime) gets
+ * charged to that process as well */
+int pscnv_gem_open_object(struct drm_gem_object *obj, struct drm_file *file_priv)
+{
+	struct drm_device *dev = obj->dev;
+	struct pscnv_bo *vo = obj->driver_private;
+	struct pscnv_client *cl;
+	
+	if (!vo->client) {
+		return 0;
+	}
+	
+	cl = pscnv_client_search_pid(dev, file_priv->pid);
+	if (!cl) {
+		return 0;
+	}
+	
+	return pscnv_bo_share(vo, cl);
+}
+
 void pscnv_gem_close_object(struct drm_gem_object *obj, struct drm_file *file_priv)
 {
 	struct drm_device *dev = obj->dev;
 	struct pscnv_bo *vo = obj->driver_private;
+	struct pscnv_client *cl;
 	
 	if (pscnv_mem_debug >= 1) {
 		NV_INFO(dev, "pscnv_gem_close_object: cookie=%08x/%d "
@@ -81,7 +103,13 @@ void pscnv_gem_close_object(struct drm_gem_object *obj, struct drm_file *file_pr
 			atomic_read(&obj->handle_count));
 	}
 	
-	/* nothing to do here, see drm_gem_handle_delete, which calls this function */
+	/* see drm_gem_handle_delete, which calls this function */
+	if (vo->client) {
+		cl = pscnv_client_search_pid(dev, file_priv->pid);
+		if (cl) {
+			pscnv_bo_unshare(vo, cl);
+		}
+	}
 }
 
 struct drm_gem_object *pscnv_gem_wrap(struct drm_device *dev, struct pscnv_bo *vo)
@@ -30,6 +30,7 @@
 struct pscnv_client;
 
 void pscnv_gem_free_object (struct drm_gem_object *);
+int pscnv_gem_open_object(struct drm_gem_object *obj, struct drm_file *file_priv);
 void pscnv_gem_close_object(struct drm_gem_object *obj, struct drm_file *file_priv);
 struct drm_gem_object *pscnv_gem_new(struct drm_device *dev, uint64_t size,
 		uint32_t flags,	uint32_t tile_flags, uint32_t cookie,
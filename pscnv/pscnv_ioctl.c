@@ -12,6 +12,8 @@
 #include "nvc0_graph.h"
 #include "pscnv_kapi.h"
 
+#include <linux/uaccess.h>
+
 #include "nvc0_pgraph.xml.h"
 
 #ifdef PSCNV_KAPI_GETPARAM_BUS_TYPE
@@ -193,6 +195,121 @@ int pscnv_ioctl_gem_info(struct drm_device *dev, void *data,
 	return 0;
 }
 
+static uint8_t
+pscnv_chunk_residency(struct pscnv_chunk *cnk)
+{
+	switch (cnk->alloc_type) {
+		case PSCNV_CHUNK_VRAM:
+			return PSCNV_RESIDENCY_VRAM;
+		case PSCNV_CHUNK_SYSRAM:
+			if (cnk->flags & PSCNV_CHUNK_SWAPPED)
+				return PSCNV_RESIDENCY_SWAPPED;
+			return PSCNV_RESIDENCY_SYSRAM;
+		case PSCNV_CHUNK_SWAPSTORE:
+			return PSCNV_RESIDENCY_SWAPPED;
+		default:
+			return PSCNV_RESIDENCY_UNALLOCATED;
+	}
+}
+
+int pscnv_ioctl_gem_residency(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct drm_pscnv_gem_residency *req = data;
+	struct drm_gem_object *obj;
+	struct pscnv_bo *bo;
+	struct pscnv_chunk *cnk;
+	uint8_t *residency = NULL;
+	uint32_t n_copy = 0;
+	uint32_t i;
+	uint8_t r;
+	int ret = 0;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	obj = drm_gem_object_lookup(dev, file_priv, req->handle);
+	if (!obj)
+		return -EBADF;
+
+	bo = obj->driver_private;
+
+	if (req->residency) {
+		n_copy = min(req->n_chunks, bo->n_chunks);
+		residency = kzalloc((n_copy + 3) / 4, GFP_KERNEL);
+		if (!residency) {
+			drm_gem_object_unreference_unlocked(obj);
+			return -ENOMEM;
+		}
+	}
+
+	req->n_chunks = bo->n_chunks;
+	req->chunk_size = dev_priv->chunk_size;
+	req->vram_bytes = 0;
+	req->sysram_bytes = 0;
+	req->swapped_bytes = 0;
+
+	/* this is just a snapshot, chunks may be swapped at any time */
+	for (i = 0; i < bo->n_chunks; i++) {
+		cnk = &bo->chunks[i];
+		r = pscnv_chunk_residency(cnk);
+
+		switch (r) {
+			case PSCNV_RESIDENCY_VRAM:
+				req->vram_bytes += pscnv_chunk_size(cnk);
+				break;
+			case PSCNV_RESIDENCY_SYSRAM:
+				req->sysram_bytes += pscnv_chunk_size(cnk);
+				break;
+			case PSCNV_RESIDENCY_SWAPPED:
+				req->swapped_bytes += pscnv_chunk_size(cnk);
+				break;
+		}
+
+		if (i < n_copy)
+			residency[i / 4] |= r << (2 * (i % 4));
+	}
+
+	if (residency) {
+		if (copy_to_user((void __user *)(unsigned long)req->residency,
+				 residency, (n_copy + 3) / 4))
+			ret = -EFAULT;
+		kfree(residency);
+	}
+
+	drm_gem_object_unreference_unlocked(obj);
+
+	return ret;
+}
+
+int pscnv_ioctl_gem_advise(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_gem_advise *req = data;
+	struct drm_gem_object *obj;
+	struct pscnv_bo *bo;
+
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+
+	if (req->advice > PSCNV_ADVICE_DONTNEED)
+		return -EINVAL;
+
+	obj = drm_gem_object_lookup(dev, file_priv, req->handle);
+	if (!obj)
+		return -EBADF;
+
+	bo = obj->driver_private;
+
+	/* only a hint for the order of swap-ins, no locking required */
+	bo->advice = req->advice;
+	if (req->advice == PSCNV_ADVICE_WILLNEED)
+		pscnv_bo_touch(bo);
+
+	drm_gem_object_unreference_unlocked(obj);
+
+	return 0;
+}
+
 int
 pscnv_ioctl_copy_to_host(struct drm_device *dev, void *data,
 						struct drm_file *file_priv)
@@ -214,6 +331,48 @@ pscnv_ioctl_copy_to_host(struct drm_device *dev, void *data,
 	return 0;
 }
 
+int
+pscnv_ioctl_vram_budget(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_vram_budget *req = data;
+	struct pscnv_client *cl;
+	
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+	
+	/* a process without client record has no VRAM, but it may still be
+	 * interested in the share it would get */
+	cl = pscnv_client_search_pid(dev, file_priv->pid);
+	
+	pscnv_swapping_vram_budget(dev, cl, req);
+	
+	return 0;
+}
+
+int
+pscnv_ioctl_pressure_notify(struct drm_device *dev, void *data,
+						struct drm_file *file_priv)
+{
+	struct drm_pscnv_pressure_notify *req = data;
+	struct pscnv_client *cl;
+	
+	NOUVEAU_CHECK_INITIALISED_WITH_RETURN;
+	
+	if (req->mask & ~PSCNV_PRESSURE_ALL) {
+		return -EINVAL;
+	}
+	
+	cl = pscnv_client_search_pid(dev, file_priv->pid);
+	
+	if (!cl) {
+		NV_ERROR(dev, "process with pid %d called pressure_notify, but "
+			      "has no client record\n", file_priv->pid);
+		return -ENOENT;
+	}
+	
+	return pscnv_client_pressure_notify(cl, req->fd, req->mask, &req->events);
+}
+
 static struct pscnv_vspace *
 pscnv_get_vspace(struct drm_device *dev, struct drm_file *file_priv, int vid)
 {
@@ -302,8 +461,10 @@ int pscnv_ioctl_vspace_map(struct drm_device *dev, void *data,
 	bo = obj->driver_private;
 
 	ret = pscnv_vspace_map(vs, bo, req->start, req->end, req->back, &map);
-	if (!ret)
+	if (!ret) {
 		req->offset = map->start;
+		pscnv_bo_touch(bo);
+	}
 
 	drm_gem_object_unreference_unlocked(obj);
 
@@ -382,6 +543,7 @@ pscnv_get_chan(struct drm_device *dev, struct drm_file *file_priv, int cid)
 int pscnv_ioctl_chan_new(struct drm_device *dev, void *data,
 						struct drm_file *file_priv)
 {
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct drm_pscnv_chan_new *req = data;
 	struct pscnv_vspace *vs;
 	struct pscnv_chan *ch;
@@ -409,7 +571,12 @@ int pscnv_ioctl_chan_new(struct drm_device *dev, void *data,
 	client = pscnv_client_search_pid(dev, file_priv->pid);
 	if (client) {
 		ch->client = client;
+		mutex_lock(&dev_priv->clients->lock);
 		list_add_tail(&ch->client_list, &client->channels);
+		mutex_unlock(&dev_priv->clients->lock);
+		
+		/* the new channel may access all swapped memory */
+		pscnv_swapping_unpark_client(client);
 	}
 	
 	return 0;
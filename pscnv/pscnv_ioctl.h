@@ -29,6 +29,14 @@ int pscnv_ioctl_fifo_init_ib(struct drm_device *dev, void *data,
 						struct drm_file *file_priv);
 int pscnv_ioctl_fifo_resume_ib(struct drm_device *dev, void *data,
 						struct drm_file *file_priv);
+int pscnv_ioctl_gem_residency(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
+int pscnv_ioctl_gem_advise(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
+int pscnv_ioctl_vram_budget(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
+int pscnv_ioctl_pressure_notify(struct drm_device *dev, void *data,
+						struct drm_file *file_priv);
 int pscnv_ioctl_copy_to_host(struct drm_device *dev, void *data,
 						struct drm_file *file_priv);
 
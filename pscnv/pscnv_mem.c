@@ -32,12 +32,15 @@
 #include <linux/list.h>
 #include <linux/kernel.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/math64.h>
 #endif
 
 #include "pscnv_vram.h"
 #include "pscnv_sysram.h"
 #include "pscnv_client.h"
 #include "pscnv_swapping.h"
+#include "pscnv_swapstore.h"
 
 void
 pscnv_bo_memset(struct pscnv_bo* bo, uint32_t val)
@@ -105,6 +108,7 @@ pscnv_chunk_alloc_type_str(uint32_t at)
 		case PSCNV_CHUNK_UNALLOCATED:	return "UNALLOCATED";
 		case PSCNV_CHUNK_VRAM: 		return "VRAM";
 		case PSCNV_CHUNK_SYSRAM:	return "SYSRAM";
+		case PSCNV_CHUNK_SWAPSTORE:	return "SWAPSTORE";
 		default:			return "(UNKNOWN)";
 	}
 }
@@ -133,6 +137,54 @@ pscnv_chunk_warn_wrong_alloc_type(struct pscnv_chunk *cnk, uint32_t expected, co
 			pscnv_chunk_alloc_type_str(expected));
 }
 
+static void
+pscnv_mem_free_work_func(struct work_struct *work)
+{
+	struct drm_nouveau_private *dev_priv =
+		container_of(work, struct drm_nouveau_private, free_work);
+	struct pscnv_client *cl;
+	struct pscnv_bo *bo;
+	
+	spin_lock(&dev_priv->free_lock);
+	while (!list_empty(&dev_priv->free_list)) {
+		bo = list_first_entry(&dev_priv->free_list, struct pscnv_bo,
+				      free_entry);
+		list_del(&bo->free_entry);
+		spin_unlock(&dev_priv->free_lock);
+		
+		cl = bo->client;
+		pscnv_mem_free(bo);
+		pscnv_client_unref(cl);
+		
+		spin_lock(&dev_priv->free_lock);
+	}
+	spin_unlock(&dev_priv->free_lock);
+}
+
+bool
+pscnv_mem_flush_free(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	
+	return flush_work(&dev_priv->free_work);
+}
+
+bool
+pscnv_mem_kick_free(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	bool pending;
+	
+	spin_lock(&dev_priv->free_lock);
+	pending = !list_empty(&dev_priv->free_list);
+	spin_unlock(&dev_priv->free_lock);
+	
+	if (pending)
+		queue_work(system_wq, &dev_priv->free_work);
+	
+	return pending;
+}
+
 int
 pscnv_mem_init(struct drm_device *dev)
 {
@@ -164,6 +216,9 @@ pscnv_mem_init(struct drm_device *dev)
 
 	spin_lock_init(&dev_priv->pramin_lock);
 	mutex_init(&dev_priv->vram_mutex);
+	spin_lock_init(&dev_priv->free_lock);
+	INIT_LIST_HEAD(&dev_priv->free_list);
+	INIT_WORK(&dev_priv->free_work, pscnv_mem_free_work_func);
 	
 	switch (dev_priv->card_type) {
 		case NV_50:
@@ -224,6 +279,18 @@ pscnv_mem_alloc(struct drm_device *dev,
 	}
 	
 	n_chunks = (dev_priv->chunk_size > 0) ? DIV_ROUND_UP(size, dev_priv->chunk_size) : 1; 
+	
+	switch (flags & PSCNV_GEM_MEMTYPE_MASK) {
+		case PSCNV_GEM_SYSRAM_SNOOP:
+		case PSCNV_GEM_SYSRAM_NOSNOOP:
+			if (!pscnv_client_host_quota_ok(client, size)) {
+				NV_INFO(dev, "MEM: client %s exceeds its limit "
+					"of %dMiB, refusing SYSRAM BO %08x\n",
+					client->comm, pscnv_swap_client_limit,
+					cookie);
+				return 0;
+			}
+	}
 
 	res = kzalloc (sizeof(struct pscnv_bo) + n_chunks*sizeof(struct pscnv_chunk), GFP_KERNEL);
 	if (!res) {
@@ -241,6 +308,13 @@ pscnv_mem_alloc(struct drm_device *dev,
 	res->n_chunks = n_chunks;
 	
 	kref_init(&res->ref);
+	spin_lock_init(&res->share_lock);
+	INIT_LIST_HEAD(&res->sharers);
+	mutex_init(&res->maps_lock);
+	INIT_LIST_HEAD(&res->maps);
+	init_waitqueue_head(&res->swap_wq);
+	res->last_access = jiffies;
+	res->advice = PSCNV_ADVICE_NORMAL;
 
 	/* XXX: another mutex? */
 	mutex_lock(&dev_priv->vram_mutex);
@@ -379,9 +453,7 @@ pscnv_chunk_free(struct pscnv_chunk *cnk)
 				bo->cookie, bo->serial, cnk->idx);
 			break;
 		case PSCNV_CHUNK_VRAM:
-			if (bo->client) {
-				atomic64_sub(size, &bo->client->vram_demand);
-			}
+			pscnv_bo_charge(bo, PSCNV_CHARGE_DEMAND, -(int64_t)size);
 			
 			mutex_lock(&dev_priv->vram_mutex);
 			pscnv_vram_free_chunk(cnk);
@@ -389,6 +461,9 @@ pscnv_chunk_free(struct pscnv_chunk *cnk)
 			break;
 		case PSCNV_CHUNK_SYSRAM:
 			pscnv_sysram_free_chunk(cnk);
+			break;
+		case PSCNV_CHUNK_SWAPSTORE:
+			pscnv_swapstore_free_chunk(cnk);
 	}
 }
 
@@ -458,6 +533,15 @@ pscnv_mem_free(struct pscnv_bo *bo)
 		pscnv_chunk_free(&bo->chunks[i]);
 	}
 	
+	/* all GEM handles should have been closed by now */
+	while (!list_empty(&bo->sharers)) {
+		struct pscnv_bo_sharer *sharer = list_first_entry(
+				&bo->sharers, struct pscnv_bo_sharer, list);
+		WARN_ON(1);
+		sharer->handles = 1;
+		pscnv_bo_unshare(bo, sharer->client);
+	}
+	
 	memset(bo, 0x33, sizeof(struct pscnv_bo) + bo->n_chunks*sizeof(struct pscnv_chunk));
 	
 	kfree (bo);
@@ -465,6 +549,190 @@ pscnv_mem_free(struct pscnv_bo *bo)
 }
 
 
+/* change the counter of cl that belongs to kind, along with the sum over all
+ * clients */
+static void
+pscnv_bo_charge_client(struct pscnv_client *cl, int kind, int64_t delta)
+{
+	switch (kind) {
+	case PSCNV_CHARGE_USAGE:
+		pscnv_client_usage_add(cl, delta);
+		return;
+	case PSCNV_CHARGE_DEMAND:
+		pscnv_client_demand_add(cl, delta);
+		return;
+	}
+	
+	BUG();
+}
+
+/* move charges from bo->client to the sharers (or back), so that everybody
+ * pays the same. Called with share_lock held */
+static void
+pscnv_bo_rebalance_locked(struct pscnv_bo *bo)
+{
+	struct pscnv_bo_sharer *cur;
+	int64_t share, diff;
+	int n = 1;
+	int k;
+	
+	list_for_each_entry(cur, &bo->sharers, list) {
+		n++;
+	}
+	
+	for (k = 0; k < PSCNV_CHARGE_KINDS; k++) {
+		share = div_s64(bo->charged[k], n);
+		list_for_each_entry(cur, &bo->sharers, list) {
+			diff = share - cur->charged[k];
+			if (!diff)
+				continue;
+			pscnv_bo_charge_client(cur->client, k, diff);
+			pscnv_bo_charge_client(bo->client, k, -diff);
+			cur->charged[k] = share;
+		}
+	}
+}
+
+void
+pscnv_bo_charge(struct pscnv_bo *bo, int kind, int64_t delta)
+{
+	if (!bo->client) {
+		return;
+	}
+	
+	spin_lock(&bo->share_lock);
+	if (bo->dead) {
+		spin_unlock(&bo->share_lock);
+		return;
+	}
+	bo->charged[kind] += delta;
+	pscnv_bo_charge_client(bo->client, kind, delta);
+	if (!list_empty(&bo->sharers)) {
+		pscnv_bo_rebalance_locked(bo);
+	}
+	spin_unlock(&bo->share_lock);
+}
+
+static struct pscnv_bo_sharer *
+pscnv_bo_find_sharer_locked(struct pscnv_bo *bo, struct pscnv_client *cl)
+{
+	struct pscnv_bo_sharer *cur;
+	
+	list_for_each_entry(cur, &bo->sharers, list) {
+		if (cur->client == cl) {
+			return cur;
+		}
+	}
+	
+	return NULL;
+}
+
+int
+pscnv_bo_share(struct pscnv_bo *bo, struct pscnv_client *cl)
+{
+	struct pscnv_bo_sharer *sharer, *new;
+	
+	if (!bo->client || !cl || cl == bo->client) {
+		return 0;
+	}
+	
+	new = kzalloc(sizeof(struct pscnv_bo_sharer), GFP_KERNEL);
+	if (!new) {
+		return -ENOMEM;
+	}
+	
+	spin_lock(&bo->share_lock);
+	sharer = pscnv_bo_find_sharer_locked(bo, cl);
+	if (sharer) {
+		sharer->handles++;
+	} else {
+		pscnv_client_ref(cl);
+		new->client = cl;
+		new->handles = 1;
+		list_add_tail(&new->list, &bo->sharers);
+		pscnv_bo_rebalance_locked(bo);
+		new = NULL;
+	}
+	spin_unlock(&bo->share_lock);
+	
+	if (new) {
+		kfree(new);
+	} else if (pscnv_mem_debug >= 1) {
+		NV_INFO(bo->dev, "MEM: %08x/%d of client %d is now shared with "
+			"client %d\n", bo->cookie, bo->serial, bo->client->pid,
+			cl->pid);
+	}
+	
+	return 0;
+}
+
+void
+pscnv_bo_unshare(struct pscnv_bo *bo, struct pscnv_client *cl)
+{
+	struct pscnv_bo_sharer *sharer;
+	int k;
+	
+	spin_lock(&bo->share_lock);
+	sharer = pscnv_bo_find_sharer_locked(bo, cl);
+	if (!sharer || --sharer->handles > 0) {
+		spin_unlock(&bo->share_lock);
+		return;
+	}
+	
+	/* the owner takes back the charges and shares them again */
+	for (k = 0; k < PSCNV_CHARGE_KINDS; k++) {
+		pscnv_bo_charge_client(cl, k, -sharer->charged[k]);
+		pscnv_bo_charge_client(bo->client, k, sharer->charged[k]);
+	}
+	list_del(&sharer->list);
+	pscnv_bo_rebalance_locked(bo);
+	spin_unlock(&bo->share_lock);
+	
+	/* may free the client, which takes the clients lock */
+	pscnv_client_unref(cl);
+	kfree(sharer);
+}
+
+int
+pscnv_bo_collect_sharers(struct pscnv_bo *bo, struct pscnv_client **cls, int *n, int max)
+{
+	struct pscnv_bo_sharer *cur;
+	int i, ret = 0;
+	
+	spin_lock(&bo->share_lock);
+	list_for_each_entry(cur, &bo->sharers, list) {
+		for (i = 0; i < *n; i++) {
+			if (cls[i] == cur->client)
+				break;
+		}
+		if (i < *n)
+			continue;
+		if (*n == max) {
+			ret = -ENOSPC;
+			break;
+		}
+		pscnv_client_ref(cur->client);
+		cls[(*n)++] = cur->client;
+	}
+	spin_unlock(&bo->share_lock);
+	
+	return ret;
+}
+
+int
+pscnv_bo_count_sharers(struct pscnv_bo *bo)
+{
+	struct pscnv_bo_sharer *cur;
+	int n = 0;
+	
+	spin_lock(&bo->share_lock);
+	list_for_each_entry(cur, &bo->sharers, list) {
+		n++;
+	}
+	spin_unlock(&bo->share_lock);
+	
+	return n;
+}
 
 int
 pscnv_bo_map_bar1(struct pscnv_bo* bo)
@@ -499,11 +767,51 @@ pscnv_bo_map_bar1(struct pscnv_bo* bo)
 	return 0;
 }
 
+/* give back everything that is charged for bo to its client and sharers, as
+ * if all its memory had already been freed */
+static void
+pscnv_bo_drop_charges(struct pscnv_bo *bo)
+{
+	int64_t total;
+	int k;
+	
+	spin_lock(&bo->share_lock);
+	for (k = 0; k < PSCNV_CHARGE_KINDS; k++) {
+		total = bo->charged[k];
+		bo->charged[k] = 0;
+		/* the sharers pass their part back to the client */
+		pscnv_bo_rebalance_locked(bo);
+		pscnv_bo_charge_client(bo->client, k, -total);
+	}
+	bo->dead = true;
+	spin_unlock(&bo->share_lock);
+}
+
 void
 pscnv_bo_ref_free(struct kref *ref)
 {
 	struct pscnv_bo *bo = container_of(ref, struct pscnv_bo, ref);
-	pscnv_mem_free(bo);
+	struct drm_device *dev = bo->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	
+	if (!bo->client) {
+		pscnv_mem_free(bo);
+		return;
+	}
+	
+	/* user BOs mostly go away in large numbers when their process exits.
+	 * Let the process go on right away, but make the VRAM available to
+	 * everybody else before it is actually freed. The worker holds a
+	 * reference on the client until then */
+	pscnv_swapping_cancel_bo(bo);
+	pscnv_bo_drop_charges(bo);
+	pscnv_client_ref(bo->client);
+	
+	spin_lock(&dev_priv->free_lock);
+	list_add_tail(&bo->free_entry, &dev_priv->free_list);
+	spin_unlock(&dev_priv->free_lock);
+	
+	schedule_work(&dev_priv->free_work);
 }
 
 static uint32_t
@@ -552,6 +860,11 @@ nv_rv32_chunk(struct pscnv_chunk *cnk, unsigned offset)
 			return nv_rv32_vram_slowpath(cnk, offset);
 		case PSCNV_CHUNK_SYSRAM:
 			return nv_rv32_sysram(cnk, offset);
+		case PSCNV_CHUNK_SWAPSTORE:
+			NV_ERROR(dev, "nv_rv32_chunk: reading from parked "
+				"chunk %08x/%d-%u at offset %x\n",
+				bo->cookie, bo->serial, cnk->idx, offset);
+			return 42;
 	}
 	
 	WARN_ON(1);
@@ -636,6 +949,11 @@ nv_wv32_chunk(struct pscnv_chunk *cnk, unsigned offset, uint32_t val)
 		case PSCNV_CHUNK_SYSRAM:
 			nv_wv32_sysram(cnk, offset, val);
 			return;
+		case PSCNV_CHUNK_SWAPSTORE:
+			NV_ERROR(dev, "nv_wv32_chunk: writing to parked "
+				"chunk %08x/%d-%u at offset %x\n",
+				bo->cookie, bo->serial, cnk->idx, offset);
+			return;
 	}
 	
 	WARN_ON(1);
@@ -733,7 +1051,7 @@ pscnv_mem_vram_usage_effective(struct drm_device *dev)
 uint64_t
 pscnv_mem_vram_usage_effective_unlocked(struct drm_device *dev)
 {
-	uint64_t vram_usage = pscnv_clients_vram_usage_unlocked(dev);
+	uint64_t vram_usage = pscnv_clients_vram_usage(dev);
 	
 	return pscnv_mem_vram_usage_effective_common(dev, vram_usage);
 }
\ No newline at end of file
@@ -29,6 +29,8 @@
 #include "pscnv_drm.h"
 #include "pscnv_mm.h"
 
+#include <linux/scatterlist.h>
+
 #define PSCNV_MEM_PAGE_SIZE 0x1000
 
 /* VRAM that is reserved for the driver. The lowest PSCNV_VRAM_RESERVED bytes
@@ -37,20 +39,42 @@
 
 struct pscnv_vspace;
 struct pscnv_client;
-
-struct pscnv_page_and_dma {
-	struct page *k; /* kernel page data */
-	dma_addr_t dma;
-};
+struct pscnv_swapstore_entry;
+struct pscnv_swaptask;
 
 /* chunk.alloc_type */
 #define PSCNV_CHUNK_UNALLOCATED  0 /* no memory has been allocated for this chunk, yet */
 #define PSCNV_CHUNK_VRAM         1 /* a regular chunk in VRAM */
 #define PSCNV_CHUNK_SYSRAM       2 /* a chunk that is allocated in SYSRAM, as
                                     * userspace explicitly asked for */
+#define PSCNV_CHUNK_SWAPSTORE    3 /* a swapped chunk that is kept compressed
+                                    * in the swapstore, see pscnv_swapstore.h */
 
 /* chunk.flags */
 #define PSCNV_CHUNK_SWAPPED      1 /* this chunk is involuntarily SYSRAM */
+#define PSCNV_CHUNK_SYSRAM_LP    2 /* all DMA segments of the SYSRAM chunk
+                                    * start and end on a boundary of
+                                    * PSCNV_SYSRAM_LP_SHIFT */
+
+/* alignment of the DMA segments of a PSCNV_CHUNK_SYSRAM_LP chunk, matches the
+ * large pages of the GPU */
+#define PSCNV_SYSRAM_LP_SHIFT    17
+
+/* kinds of memory that are charged by pscnv_bo_charge */
+#define PSCNV_CHARGE_USAGE       0 /* pscnv_client.vram_usage */
+#define PSCNV_CHARGE_DEMAND      1 /* pscnv_client.vram_demand */
+#define PSCNV_CHARGE_KINDS       2
+
+/* a client that has a GEM handle to a BO allocated by another client */
+struct pscnv_bo_sharer {
+	struct list_head list;
+	/* holds a reference */
+	struct pscnv_client *client;
+	/* number of GEM handles that client has to the BO */
+	int handles;
+	/* part of pscnv_bo.charged that client is charged with */
+	int64_t charged[PSCNV_CHARGE_KINDS];
+};
 
 /** ALLCATION RULES:
  *
@@ -80,19 +104,44 @@ struct pscnv_chunk {
 	/* position in bo->chunks[] array */
 	uint32_t idx; 
 	
-	/* currently either PSCNV_CHUNK_SWAPPED or 0 */
+	/* PSCNV_CHUNK_SWAPPED and PSCNV_CHUNK_SYSRAM_LP */
 	uint16_t flags;
 	
 	/* one of PSCNV_CHUNK_UNALLOCATED, PSCNV_CHUNK_VRAM, ... */
 	uint16_t alloc_type;
 	
+	/* swaptask that this chunk is queued in and its position in
+	 * swaptask->selected. swaptask is NULL if the chunk is not queued or
+	 * its copy has already started. Protected by bo->client->lock */
+	struct pscnv_swaptask *swaptask;
+	size_t swaptask_idx;
+	
+	/* list of the client (swapping_options, already_swapped or
+	 * swap_pending) that this chunk is in and its position there. list
+	 * is NULL if the chunk is in none of them. Protected by
+	 * bo->client->lock */
+	struct pscnv_chunk_list *list;
+	size_t list_idx;
+	
+	/* swap-in benefit at the last pscnv_chunk_list_sort_unlocked, the
+	 * sort key of already_swapped. Protected by bo->client->lock */
+	int64_t swapin_benefit;
+	
 	union {
 		/* PSCNV_CHUNK_VRAM only: first node of phyisical allocation
 		 * of this chunk */
 		struct pscnv_mm_node *vram_node;
-		/* PSCNV_CHUNK_SYSRAM: pages and corresponding DMA addresses */
-		struct pscnv_page_and_dma *pages;
+		/* PSCNV_CHUNK_SYSRAM: pages, merged into runs of contiguous
+		 * pages, and their DMA mapping. sgt->nents is the number of
+		 * DMA segments, which may be less than sgt->orig_nents */
+		struct sg_table *sgt;
+		/* PSCNV_CHUNK_SWAPSTORE: compressed contents */
+		struct pscnv_swapstore_entry *stored;
 	};
+	
+	/* PSCNV_CHUNK_SYSRAM only: all pages of sgt in order, so a single page
+	 * can be found without walking the scatterlist */
+	struct page **pages;
 };
 
 /* A VRAM object of any kind. */
@@ -120,12 +169,41 @@ struct pscnv_bo {
 	struct pscnv_chan *chan;
 	/* number of references to this buffer object */
 	struct kref ref;
-	/* vm memory node (one continuos area) that will be replaced with
-	 * system RAM. Currently the BO is simply removed from other vspaces */
+	/* first mapping of this BO in a user vspace */
 	struct pscnv_mm_node *primary_node;
+	/* number of mappings in user vspaces, including the primary node */
+	atomic_t vm_maps;
+	/* protects maps and the PTEs of all nodes in it */
+	struct mutex maps_lock;
+	/* reverse map: all nodes that map this BO in user vspaces, linked by
+	 * pscnv_mm_node.bo_maps. Swapping updates all of them */
+	struct list_head maps;
 
 	/* client who allocated this bo, if it was allocated by a user space process */
 	struct pscnv_client *client;
+	
+	/* protects sharers and charged */
+	spinlock_t share_lock;
+	/* list of pscnv_bo_sharer, other clients that use this bo */
+	struct list_head sharers;
+	/* memory charged for this bo. Split evenly between client and all
+	 * sharers, client gets the remainder */
+	int64_t charged[PSCNV_CHARGE_KINDS];
+	/* set when the last reference is gone and the charges have been
+	 * dropped, pscnv_bo_charge ignores the bo from then on */
+	bool dead;
+	/* position in dev_priv->free_list */
+	struct list_head free_entry;
+	/* number of chunks in the swap_pending list of client */
+	atomic_t swaps_pending;
+	/* woken up when swaps_pending drops to 0 */
+	wait_queue_head_t swap_wq;
+	
+	/* jiffies of the last known access, see pscnv_bo_touch */
+	unsigned long last_access;
+	/* PSCNV_ADVICE_*, set through the gem_advise ioctl */
+	int advice;
+	
 	/* if this pointer is set, use this memory area to access the VRAM contents
 	   of this bo (see nouveau_drv.h: nv_rv32, nv_wv32). This pointer should
 	   be set, if the BO is mapped to BAR 1 */
@@ -189,8 +267,44 @@ static inline void pscnv_bo_unref(struct pscnv_bo *bo) {
 	kref_put(&bo->ref, pscnv_bo_ref_free);
 }
 
+/* remember that bo has just been used. The GPU does not tell us about its
+ * accesses, so this is called on CPU faults, new mappings, WILLNEED hints
+ * and on every access through the gdev interface */
+static inline void pscnv_bo_touch(struct pscnv_bo *bo) {
+	bo->last_access = jiffies;
+}
+
 extern int pscnv_mem_free(struct pscnv_bo *);
 
+/* wait until all BOs whose last reference has been dropped are actually
+ * freed. Returns true, if there were any */
+extern bool pscnv_mem_flush_free(struct drm_device *dev);
+
+/* make sure the free worker runs, but do not wait for it. Returns true, if
+ * there are BOs waiting to be freed */
+extern bool pscnv_mem_kick_free(struct drm_device *dev);
+
+/* add delta bytes of PSCNV_CHARGE_* memory to the clients of bo */
+void
+pscnv_bo_charge(struct pscnv_bo *bo, int kind, int64_t delta);
+
+/* called when cl gets a handle to bo */
+int
+pscnv_bo_share(struct pscnv_bo *bo, struct pscnv_client *cl);
+
+/* called when cl closes a handle to bo */
+void
+pscnv_bo_unshare(struct pscnv_bo *bo, struct pscnv_client *cl);
+
+/* add all sharers of bo that are not yet in cls to cls, with a reference.
+ * Returns -ENOSPC if that would take more than max entries */
+int
+pscnv_bo_collect_sharers(struct pscnv_bo *bo, struct pscnv_client **cls, int *n, int max);
+
+/* number of clients that share bo with its owner */
+int
+pscnv_bo_count_sharers(struct pscnv_bo *bo);
+
 void
 pscnv_chunk_free(struct pscnv_chunk *cnk);
 
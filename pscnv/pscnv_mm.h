@@ -33,6 +33,7 @@ struct pscnv_mm_node {
 	struct pscnv_bo *bo;
 	struct pscnv_chunk *chunk; /* < only for vram nodes */
 	struct pscnv_vspace *vspace;
+	struct list_head bo_maps; /* < only for nodes in user vspaces, see pscnv_bo.maps */
 };
 
 #define PSCNV_MM_T1		1
@@ -52,6 +52,8 @@ pscnv_gem_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 		return VM_FAULT_SIGBUS;
 	}
 	
+	pscnv_bo_touch(bo);
+	
 	return bo->vm_fault(bo, vma, vmf);
 }
 
@@ -135,7 +137,7 @@ pscnv_mmap(struct file *filp, struct vm_area_struct *vma)
 			 * able to steal control to it later, as it may be used
 			 * as indirect buffer */
 			return remap_pfn_range(vma, vma->vm_start, 
-				page_to_pfn(bo->chunks[0].pages[0].k),
+				page_to_pfn(sg_page(bo->chunks[0].sgt->sgl)),
 				vma->vm_end - vma->vm_start, PAGE_SHARED);
 		}
 
@@ -5,9 +5,14 @@
 #include "pscnv_sysram.h"
 #include "pscnv_vram.h"
 #include "pscnv_ib_chan.h"
+#include "pscnv_swapstore.h"
+#include "pscnv_chan.h"
 
 #include <linux/random.h>
+#include <linux/math64.h>
 #include <linux/completion.h>
+#include <linux/ratelimit.h>
+#include <linux/sort.h>
 
 /* BOs smaller than this size are ignored. Accept anything that is larger
  * than a Pushbuffer */
@@ -21,11 +26,18 @@
 #define PSCNV_SWAPPING_MAXOPS 64
 #define PSCNV_SWAPPING_OPS_PER_VICTIM 4
 
+/* number of swapped chunks that may be skipped for being too large, when
+ * looking for the next chunk to swap in */
+#define PSCNV_SWAPIN_SCAN_MAX 32
+
 #define PSCNV_SWAPPING_TIMEOUT 5*HZ
 
 /* delay between checks for vram increase in jiffies */
 #define PSCNV_INCREASE_RATE (HZ/1)
 
+/* delay between samples of the IB_PUT of clients with swapped chunks */
+#define PSCNV_ACTIVITY_RATE (HZ/20)
+
 #define PSCNV_INCREASE_THRESHOLD (4 << 20)
 
 #if 0
@@ -59,13 +71,45 @@ pscnv_swapping_memdump(struct pscnv_bo *bo)
 static void
 increase_vram_work_func(struct work_struct *work);
 
+static void
+activity_work_func(struct work_struct *work);
+
+static void
+pscnv_swapping_park_client(struct pscnv_client *cl);
+
+/* run the increase_vram work on the NUMA node of the card, if there is one.
+ * It parks and compresses chunks in SYSRAM */
+static void
+pscnv_swapping_schedule_increase(struct pscnv_swapping *swapping)
+{
+	if (swapping->cpu >= 0) {
+		queue_delayed_work_on(swapping->cpu, system_wq,
+			&swapping->increase_vram_work, PSCNV_INCREASE_RATE);
+	} else {
+		schedule_delayed_work(&swapping->increase_vram_work,
+			PSCNV_INCREASE_RATE);
+	}
+}
+
+static void
+pscnv_swapping_schedule_activity(struct pscnv_swapping *swapping)
+{
+	if (swapping->cpu >= 0) {
+		queue_delayed_work_on(swapping->cpu, system_wq,
+			&swapping->activity_work, PSCNV_ACTIVITY_RATE);
+	} else {
+		schedule_delayed_work(&swapping->activity_work,
+			PSCNV_ACTIVITY_RATE);
+	}
+}
+
 /* called once on driver load */
 int
 pscnv_swapping_init(struct drm_device *dev)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_swapping *swapping;
-	int ret;
+	int node, cpu;
 	
 	if (pscnv_swapping_debug >= 1) {
 		NV_INFO(dev, "pscnv_swapping: initalizing....\n");
@@ -80,12 +124,22 @@ pscnv_swapping_init(struct drm_device *dev)
 	
 	swapping->dev = dev;
 	atomic_set(&swapping->swaptask_serial, 0);
-	init_completion(&swapping->next_swap);
+	
+	swapping->cpu = -1;
+	node = dev_to_node(&dev->pdev->dev);
+	if (node != NUMA_NO_NODE) {
+		cpu = cpumask_first_and(cpumask_of_node(node), cpu_online_mask);
+		if (cpu < nr_cpu_ids)
+			swapping->cpu = cpu;
+	}
 	
 	INIT_DELAYED_WORK(&swapping->increase_vram_work, increase_vram_work_func);
-	ret = schedule_delayed_work(&swapping->increase_vram_work, PSCNV_INCREASE_RATE);
+	pscnv_swapping_schedule_increase(swapping);
 	
-	return ret;
+	INIT_DELAYED_WORK(&swapping->activity_work, activity_work_func);
+	pscnv_swapping_schedule_activity(swapping);
+	
+	return 0;
 }
 
 void
@@ -97,6 +151,7 @@ pscnv_swapping_exit(struct drm_device *dev)
 	BUG_ON(!swapping);
 	
 	cancel_delayed_work_sync(&swapping->increase_vram_work);
+	cancel_delayed_work_sync(&swapping->activity_work);
 	
 	kfree(swapping);
 	dev_priv->swapping = NULL;
@@ -106,8 +161,16 @@ pscnv_swapping_exit(struct drm_device *dev)
  * CHUNK_LIST
  ******************************************************************************/
 
-static void
-pscnv_chunk_list_add_unlocked(struct pscnv_chunk_list *list,
+/* A chunk may be in at most one of the lists of its client at a time. These
+ * lists record the position of each chunk in cnk->list and cnk->list_idx, so
+ * that membership tests and removals do not need to search.
+ *
+ * swaptask->selected is an exception: its chunks are in swap_pending at the
+ * same time, so it only gets appended to and is not tracked. */
+
+/* add cnk at the end of list without recording its position */
+static int
+pscnv_chunk_list_append_unlocked(struct pscnv_chunk_list *list,
 					struct pscnv_chunk *cnk)
 {
 	struct pscnv_bo *bo = cnk->bo;
@@ -123,11 +186,28 @@ pscnv_chunk_list_add_unlocked(struct pscnv_chunk_list *list,
 		if (ZERO_OR_NULL_PTR(list->chunks)) {
 			NV_ERROR(dev, "pscnv_swapping_option_list_add: out of "
 				"memory. chunks=%p\n", list->chunks);
-			return;
+			return -ENOMEM;
 		}
 	}
 	
 	list->chunks[list->size++] = cnk;
+	list->ordered = false;
+	
+	return 0;
+}
+
+static void
+pscnv_chunk_list_add_unlocked(struct pscnv_chunk_list *list,
+					struct pscnv_chunk *cnk)
+{
+	WARN_ON(cnk->list);
+	
+	if (pscnv_chunk_list_append_unlocked(list, cnk)) {
+		return;
+	}
+	
+	cnk->list = list;
+	cnk->list_idx = list->size - 1;
 }
 
 /* remove the n-th option from the list and return it */
@@ -142,9 +222,14 @@ pscnv_chunk_list_take_unlocked(struct pscnv_chunk_list *list, size_t n)
 	}
 	
 	ret = list->chunks[n];
+	ret->list = NULL;
 	
 	/* we always keep the options tightly packed, for better random pick */
 	list->chunks[n] = list->chunks[--list->size];
+	if (n < list->size) {
+		list->chunks[n]->list_idx = n;
+		list->ordered = false;
+	}
 	
 	return ret;
 }
@@ -170,54 +255,189 @@ pscnv_chunk_list_take_random_unlocked(struct pscnv_chunk_list *list)
 	return pscnv_chunk_list_take_unlocked(list, pscnv_swapping_roll_dice(list->size));
 }
 
-/* return idx of first chunk of given bo in list or -1 if not found */
+/* estimated benefit of moving cnk back to VRAM at time now, higher is
+ * better. Chunks of BOs that are mostly in VRAM already, that have been used
+ * recently or that userspace asked for come first */
+static int64_t
+pscnv_swapping_swap_in_benefit(struct pscnv_chunk *cnk, unsigned long now)
+{
+	struct pscnv_bo *bo = cnk->bo;
+	unsigned long age = (now - ACCESS_ONCE(bo->last_access)) / HZ;
+	int64_t resident;
+	int64_t benefit;
+	
+	spin_lock(&bo->share_lock);
+	resident = max_t(int64_t, bo->charged[PSCNV_CHARGE_USAGE], 0);
+	spin_unlock(&bo->share_lock);
+	
+	/* 0..1024, share of the BO that would no longer be split */
+	benefit = div64_u64((uint64_t)resident << 10, bo->size);
+	
+	/* 1024 for a BO that has been used within the last second */
+	benefit += 1024 / (1 + age);
+	
+	switch (bo->advice) {
+		case PSCNV_ADVICE_WILLNEED:
+			benefit += 4096;
+			break;
+		case PSCNV_ADVICE_DONTNEED:
+			benefit -= 4096;
+			break;
+	}
+	
+	return benefit;
+}
+
+/* sort order for pscnv_chunk_list_sort_unlocked: parked chunks first, then
+ * by increasing benefit. Among equal chunks, the larger one comes first.
+ * Only compares the stored benefits, so the order stays consistent while
+ * sort() runs */
 static int
-pscnv_chunk_list_find_bo(struct pscnv_chunk_list *list, struct pscnv_bo *bo)
+pscnv_swapping_swap_in_cmp(const void *a, const void *b)
 {
-	struct drm_device *dev = bo->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_chunk *x = *(struct pscnv_chunk * const *)a;
+	struct pscnv_chunk *y = *(struct pscnv_chunk * const *)b;
+	bool x_sysram = x->alloc_type == PSCNV_CHUNK_SYSRAM;
+	bool y_sysram = y->alloc_type == PSCNV_CHUNK_SYSRAM;
+	
+	if (x_sysram != y_sysram) {
+		return x_sysram ? 1 : -1;
+	}
+	
+	if (x->swapin_benefit != y->swapin_benefit) {
+		return x->swapin_benefit < y->swapin_benefit ? -1 : 1;
+	}
+	
+	if (pscnv_chunk_size(x) != pscnv_chunk_size(y)) {
+		return pscnv_chunk_size(x) > pscnv_chunk_size(y) ? -1 : 1;
+	}
+	
+	return 0;
+}
+
+/* sort list by swap-in benefit, best last */
+static void
+pscnv_chunk_list_sort_unlocked(struct pscnv_chunk_list *list)
+{
+	unsigned long now = jiffies;
 	size_t i;
 	
-	mutex_lock(&dev_priv->clients->lock);
 	for (i = 0; i < list->size; i++) {
-		if (list->chunks[i]->bo == bo) {
-			mutex_unlock(&dev_priv->clients->lock);
-			return (int)i;
-		}
+		list->chunks[i]->swapin_benefit =
+			pscnv_swapping_swap_in_benefit(list->chunks[i], now);
 	}
-	mutex_unlock(&dev_priv->clients->lock);
 	
-	return -1;
+	sort(list->chunks, list->size, sizeof(struct pscnv_chunk *),
+		pscnv_swapping_swap_in_cmp, NULL);
+	
+	for (i = 0; i < list->size; i++) {
+		list->chunks[i]->list_idx = i;
+	}
+	
+	list->ordered = true;
+	list->order_time = now;
+}
+
+/* the list is only sorted again once it has changed or after a second */
+static void
+pscnv_chunk_list_order_unlocked(struct pscnv_chunk_list *list)
+{
+	if (!list->ordered || time_after(jiffies, list->order_time + HZ)) {
+		pscnv_chunk_list_sort_unlocked(list);
+	}
+}
+
+/* true, if the list holds at least one SYSRAM chunk. Parked chunks are
+ * sorted first, so only the last one has to be looked at */
+static bool
+pscnv_chunk_list_has_sysram_unlocked(struct pscnv_chunk_list *list)
+{
+	if (pscnv_chunk_list_empty(list)) {
+		return false;
+	}
+	
+	pscnv_chunk_list_order_unlocked(list);
+	
+	return list->chunks[list->size - 1]->alloc_type == PSCNV_CHUNK_SYSRAM;
+}
+
+/* remove the SYSRAM chunk with the highest swap-in benefit that is not larger
+ * than max_size from the list and return it, or NULL if there is none.
+ *
+ * Taking the best chunks one after the other is O(1) each, as long as the
+ * list stays ordered. Chunks that do not fit are skipped, but only the best
+ * PSCNV_SWAPIN_SCAN_MAX are looked at */
+static struct pscnv_chunk*
+pscnv_chunk_list_take_best_unlocked(struct pscnv_chunk_list *list, uint64_t max_size)
+{
+	struct pscnv_chunk *cnk;
+	size_t i, scanned = 0;
+	
+	pscnv_chunk_list_order_unlocked(list);
+	
+	for (i = list->size; i > 0 && scanned < PSCNV_SWAPIN_SCAN_MAX; i--, scanned++) {
+		cnk = list->chunks[i - 1];
+		
+		if (cnk->alloc_type != PSCNV_CHUNK_SYSRAM) {
+			/* only parked chunks left */
+			return NULL;
+		}
+		
+		if (pscnv_chunk_size(cnk) <= max_size) {
+			/* keeps the order, if this is the last chunk */
+			return pscnv_chunk_list_take_unlocked(list, i - 1);
+		}
+	}
 	
+	return NULL;
 }
 
 /* return idx of chunk in list or -1 if not found */
 static int
 pscnv_chunk_list_find_unlocked(struct pscnv_chunk_list *list, struct pscnv_chunk *cnk)
 {
-	size_t i;
-	
-	for (i = 0; i < list->size; i++) {
-		if (list->chunks[i] == cnk) {
-			return (int)i;
-		}
+	if (cnk->list != list) {
+		return -1;
 	}
 	
-	return -1;
+	WARN_ON(list->chunks[cnk->list_idx] != cnk);
 	
+	return (int)cnk->list_idx;
 }
 
-static void
+/* returns false, if cnk was not in list */
+static bool
 pscnv_chunk_list_remove_unlocked(struct pscnv_chunk_list *list, struct pscnv_chunk *cnk)
 {
 	int i = pscnv_chunk_list_find_unlocked(list, cnk);
 	
 	if (i == -1) {
 		WARN_ON(1);
-		return;
+		return false;
 	}
 	
 	pscnv_chunk_list_take_unlocked(list, (size_t)i);
+	return true;
+}
+
+/* swap_pending also counts the chunks of each bo, so that freeing a bo can
+ * wait for exactly its own chunks, see pscnv_swapping_wait_for_pending_swaps */
+static void
+pscnv_swap_pending_add_unlocked(struct pscnv_client *cl, struct pscnv_chunk *cnk)
+{
+	pscnv_chunk_list_add_unlocked(&cl->swap_pending, cnk);
+	atomic_inc(&cnk->bo->swaps_pending);
+}
+
+static void
+pscnv_swap_pending_remove_unlocked(struct pscnv_client *cl, struct pscnv_chunk *cnk)
+{
+	struct pscnv_bo *bo = cnk->bo;
+	
+	if (pscnv_chunk_list_remove_unlocked(&cl->swap_pending, cnk) &&
+	    atomic_dec_and_test(&bo->swaps_pending)) {
+		wake_up_all(&bo->swap_wq);
+	}
 }
 
 /* return number of bytes of all chunks that have been removed */
@@ -225,25 +445,19 @@ static uint64_t
 pscnv_chunk_list_remove_bo_unlocked(struct pscnv_chunk_list *list, struct pscnv_bo *bo)
 {
 	struct pscnv_chunk *cnk;
-	size_t count = 0;
-	size_t i = 0;
-	size_t size_before = list->size;
 	uint64_t bytes_sum = 0;
+	uint32_t i;
 	
-	while (i < list->size) {
-		if (list->chunks[i]->bo == bo) {
-			cnk = pscnv_chunk_list_take_unlocked(list, i);
-			bytes_sum += pscnv_chunk_size(cnk);
-			count++;
-			/* no i++ here, last element is moved here and gets
-			 * checked at the next iteration */
-		} else {
-			i++;
+	for (i = 0; i < bo->n_chunks; i++) {
+		cnk = &bo->chunks[i];
+		if (cnk->list != list) {
+			continue;
 		}
+		
+		pscnv_chunk_list_take_unlocked(list, cnk->list_idx);
+		bytes_sum += pscnv_chunk_size(cnk);
 	}
 	
-	WARN_ON(size_before - count != list->size);
-	
 	return bytes_sum;
 }
 
@@ -357,11 +571,80 @@ pscnv_swaptask_add_chunk_unlocked(struct list_head *swaptasks, struct pscnv_chun
 			st->serial);
 	}
 	
-	pscnv_chunk_list_add_unlocked(&st->selected, cnk);
+	if (pscnv_chunk_list_append_unlocked(&st->selected, cnk)) {
+		return NULL;
+	}
+	cnk->swaptask = st;
+	cnk->swaptask_idx = st->selected.size - 1;
 	
 	return st;
 }
 
+/* get the i-th chunk of st, right before it is copied. Returns NULL, if the
+ * chunk has been cancelled in the meantime */
+static struct pscnv_chunk *
+pscnv_swaptask_take_chunk(struct pscnv_swaptask *st, size_t i)
+{
+	struct pscnv_chunk *cnk;
+	
+	mutex_lock(&st->tgt->lock);
+	cnk = st->selected.chunks[i];
+	if (cnk) {
+		cnk->swaptask = NULL;
+	}
+	mutex_unlock(&st->tgt->lock);
+	
+	return cnk;
+}
+
+/* drop all chunks of bo from the swaptasks they are queued in, as bo is about
+ * to be freed. Chunks whose copy has already started stay in swap_pending.
+ * Returns the number of cancelled chunks */
+static int
+pscnv_swaptask_cancel_bo_unlocked(struct pscnv_bo *bo)
+{
+	struct drm_device *dev = bo->dev;
+	struct pscnv_client *cl = bo->client;
+	struct pscnv_swaptask *st;
+	struct pscnv_chunk *cnk;
+	uint32_t i;
+	int n = 0;
+	
+	for (i = 0; i < bo->n_chunks; i++) {
+		cnk = &bo->chunks[i];
+		st = cnk->swaptask;
+		if (!st) {
+			continue;
+		}
+		
+		/* keep the positions of the other chunks, the swaptask may
+		 * be working on them right now */
+		st->selected.chunks[cnk->swaptask_idx] = NULL;
+		cnk->swaptask = NULL;
+		
+		pscnv_swap_pending_remove_unlocked(cl, cnk);
+		
+		/* undo prepare_for_swap_out / prepare_for_swap_in */
+		if (cnk->alloc_type == PSCNV_CHUNK_VRAM) {
+			pscnv_bo_charge(bo, PSCNV_CHARGE_DEMAND,
+					pscnv_chunk_size(cnk));
+			atomic64_sub(pscnv_chunk_size(cnk), &cl->sysram_reserved);
+		} else {
+			pscnv_bo_charge(bo, PSCNV_CHARGE_DEMAND,
+					-(int64_t)pscnv_chunk_size(cnk));
+		}
+		
+		if (pscnv_swapping_debug >= 2) {
+			NV_INFO(dev, "Swapping: cancelled chunk %08x/%d-%u in "
+				"swaptask %d\n", bo->cookie, bo->serial, cnk->idx,
+				st->serial);
+		}
+		n++;
+	}
+	
+	return n;
+}
+
 static int
 pscnv_vram_to_host(struct pscnv_chunk* vram)
 {
@@ -369,8 +652,6 @@ pscnv_vram_to_host(struct pscnv_chunk* vram)
 	struct drm_device *dev = bo->dev;
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_chunk sysram; /* temporarily on stack */
-	struct pscnv_mm_node *primary_node = bo->primary_node;
-	struct pscnv_vspace *vs = NULL;
 	int res;
 	
 	if (!dev_priv->dma) {
@@ -386,24 +667,21 @@ pscnv_vram_to_host(struct pscnv_chunk* vram)
 		return -EINVAL;
 	}
 	
-	if (!primary_node && pscnv_swapping_debug >= 1) {
+	if (!bo->primary_node && pscnv_swapping_debug >= 1) {
 		NV_INFO(dev, "pscnv_swapping_replace: BO %08x/%d-%u has no "
 			"primary node attached, Strange.\n",
 			bo->cookie, bo->serial, vram->idx);
 	}
 	
-	if (primary_node)
-		vs = primary_node->vspace;
-	
 	memset(&sysram, 0, sizeof(struct pscnv_chunk));
 	sysram.flags = vram->flags | PSCNV_CHUNK_SWAPPED;
 	sysram.bo = bo;
 	sysram.idx = vram->idx;
 	
-	/* increases vram_swapped */
-	res = pscnv_sysram_alloc_chunk(&sysram);
+	/* increases vram_swapped, the DMA transfer overwrites the whole chunk */
+	res = pscnv_sysram_swap_alloc_chunk(&sysram);
 	if (res) {
-		NV_ERROR(dev, "pscnv_vram_to_host: pscnv_sysram_alloc_chunk "
+		NV_ERROR(dev, "pscnv_vram_to_host: pscnv_sysram_swap_alloc_chunk "
 			"failed on %08x/%d-%u\n", bo->cookie, bo->serial,
 			sysram.idx);
 		goto fail_sysram_alloc;
@@ -418,18 +696,11 @@ pscnv_vram_to_host(struct pscnv_chunk* vram)
 	
 	//pscnv_swapping_memdump(sysram);
 	
-	/* this overwrites existing PTE */
-	if (vs) {
-		dev_priv->vm->do_unmap(vs,
-			primary_node->start + vram->idx * dev_priv->chunk_size,
-			pscnv_chunk_size(vram));
-		res = dev_priv->vm->do_map_chunk(vs, &sysram,
-			primary_node->start + sysram.idx * dev_priv->chunk_size);
-	
-		if (res) {
-			NV_INFO(dev, "pscnv_vram_to_host: failed to replace mapping\n");
-			goto fail_map_chunk;
-		}
+	/* this overwrites the existing PTEs in all vspaces */
+	res = pscnv_vspace_remap_chunk(&sysram);
+	if (res) {
+		NV_INFO(dev, "pscnv_vram_to_host: failed to replace mapping\n");
+		goto fail_map_chunk;
 	}
 	
 	pscnv_vram_free_chunk(vram);
@@ -438,7 +709,13 @@ pscnv_vram_to_host(struct pscnv_chunk* vram)
 	 * chunk */
 	vram->alloc_type = sysram.alloc_type;
 	vram->flags = sysram.flags;
+	vram->sgt = sysram.sgt;
 	vram->pages = sysram.pages;
+	
+	/* the VRAM at bo->start may be handed out again right away */
+	if ((bo->flags & PSCNV_GEM_CONTIG) && vram->idx == 0) {
+		bo->start = sg_dma_address(sysram.sgt->sgl);
+	}
 
 	/* refcnt of sysram now belongs to the vram bo, it will unref it,
 	   when it gets free'd itself */
@@ -447,20 +724,13 @@ pscnv_vram_to_host(struct pscnv_chunk* vram)
 
 fail_map_chunk:
 	/* reset PTEs to old value, just to be safe */
-	if (vs) {
-		dev_priv->vm->do_unmap(vs,
-			primary_node->start + sysram.idx * dev_priv->chunk_size,
-			pscnv_chunk_size(&sysram));
-		dev_priv->vm->do_map_chunk(vs, vram,
-			primary_node->start + vram->idx * dev_priv->chunk_size);
-	}
+	pscnv_vspace_remap_chunk(vram);
 
 fail_dma:
-	pscnv_sysram_free_chunk(&sysram);
+	pscnv_sysram_swap_free_chunk(&sysram);
 
 fail_sysram_alloc:
-	if (vram->bo->client)
-		atomic64_add(pscnv_chunk_size(vram), &vram->bo->client->vram_demand);
+	pscnv_bo_charge(vram->bo, PSCNV_CHARGE_DEMAND, pscnv_chunk_size(vram));
 
 	return res;
 }
@@ -472,8 +742,6 @@ pscnv_vram_from_host(struct pscnv_chunk* sysram)
 	struct drm_device *dev = bo->dev;
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_chunk vram; /* temporarily on stack */
-	struct pscnv_mm_node *primary_node = bo->primary_node;
-	struct pscnv_vspace *vs = NULL;
 	int res;
 	int flags = 0;
 	
@@ -499,19 +767,16 @@ pscnv_vram_from_host(struct pscnv_chunk* sysram)
 	}
 	WARN_ON(!(sysram->flags & PSCNV_CHUNK_SWAPPED));
 	
-	if (!primary_node && pscnv_swapping_debug >= 1) {
+	if (!bo->primary_node && pscnv_swapping_debug >= 1) {
 		NV_INFO(dev, "pscnv_swapping_replace: BO %08x/%d-%u has no "
 			"primary node attached, Strange.\n",
-			bo->cookie, bo->serial, vram.idx);
+			bo->cookie, bo->serial, sysram->idx);
 	}
 	
-	if (primary_node)
-		vs = primary_node->vspace;
-	
 	memset(&vram, 0, sizeof(struct pscnv_chunk));
 	vram.bo = bo;
 	vram.idx = sysram->idx;
-	vram.flags = sysram->flags & ~(PSCNV_CHUNK_SWAPPED);
+	vram.flags = sysram->flags & ~(PSCNV_CHUNK_SWAPPED | PSCNV_CHUNK_SYSRAM_LP);
 	
 	res = pscnv_vram_alloc_chunk(&vram, flags);
 	if (res) {
@@ -530,22 +795,15 @@ pscnv_vram_from_host(struct pscnv_chunk* sysram)
 	
 	//pscnv_swapping_memdump(sysram);
 	
-	/* this overwrites existing PTE */
-	if (vs) {
-		dev_priv->vm->do_unmap(vs,
-			primary_node->start + sysram->idx * dev_priv->chunk_size,
-			pscnv_chunk_size(sysram));
-		res = dev_priv->vm->do_map_chunk(vs, &vram,
-			primary_node->start + vram.idx * dev_priv->chunk_size);
-	
-		if (res) {
-			NV_INFO(dev, "pscnv_vram_from_host: failed to replace mapping\n");
-			goto fail_map_chunk;
-		}
+	/* this overwrites the existing PTEs in all vspaces */
+	res = pscnv_vspace_remap_chunk(&vram);
+	if (res) {
+		NV_INFO(dev, "pscnv_vram_from_host: failed to replace mapping\n");
+		goto fail_map_chunk;
 	}
 	
-	/* update vram_swapped value */
-	pscnv_sysram_free_chunk(sysram);
+	/* update vram_swapped value, the pages go back to the pool */
+	pscnv_sysram_swap_free_chunk(sysram);
 	
 	/* vram chunk is unallocated now, replace its values with the sysram
 	 * chunk */
@@ -553,28 +811,104 @@ pscnv_vram_from_host(struct pscnv_chunk* sysram)
 	sysram->flags = vram.flags;
 	sysram->vram_node = vram.vram_node;
 	
+	if ((bo->flags & PSCNV_GEM_CONTIG) && sysram->idx == 0) {
+		bo->start = vram.vram_node->start;
+	}
+	
 	return 0;
 
 fail_map_chunk:
 	/* reset PTEs to old value, just to be safe */
-	if (vs) {
-		dev_priv->vm->do_unmap(vs,
-			primary_node->start + vram.idx * dev_priv->chunk_size,
-			pscnv_chunk_size(&vram));
-		dev_priv->vm->do_map_chunk(vs, sysram,
-			primary_node->start + sysram->idx * dev_priv->chunk_size);
-	}
+	pscnv_vspace_remap_chunk(sysram);
 
 fail_dma:
 	pscnv_vram_free_chunk(&vram);
 
 fail_vram_alloc:
-	if (sysram->bo->client)
-		atomic64_sub(pscnv_chunk_size(sysram), &sysram->bo->client->vram_demand);
+	pscnv_bo_charge(sysram->bo, PSCNV_CHARGE_DEMAND, -(int64_t)pscnv_chunk_size(sysram));
 	
 	return res;
 }
 
+static DEFINE_RATELIMIT_STATE(pscnv_swapping_sharers_ratelimit, 5 * HZ, 1);
+
+/* let the sharers from index first on run again and drop them */
+static void
+pscnv_swaptask_release_sharers(struct pscnv_swaptask *st, int first)
+{
+	int i;
+	
+	for (i = first; i < st->n_sharers; i++) {
+		pscnv_client_continue_channels(&st->sharer_chans[i]);
+		pscnv_client_unref(st->sharers[i]);
+	}
+	
+	st->n_sharers = first;
+}
+
+/* pause the clients that share the BO of cnk with st->tgt, if they are not
+ * paused already. Runs on the pause thread */
+static int
+pscnv_swaptask_pause_sharers(struct pscnv_swaptask *st, struct pscnv_chunk *cnk)
+{
+	struct drm_device *dev = st->dev;
+	int first = st->n_sharers;
+	int i;
+	int ret, res;
+	
+	ret = pscnv_bo_collect_sharers(cnk->bo, st->sharers, &st->n_sharers,
+					PSCNV_SWAPTASK_MAX_SHARERS);
+	
+	if (ret == -ENOSPC && first > 0) {
+		/* the sharers of the previous chunks took up the space, let
+		 * them go and start over with the sharers of this one */
+		for (i = first; i < st->n_sharers; i++) {
+			pscnv_client_unref(st->sharers[i]);
+		}
+		st->n_sharers = first;
+		pscnv_swaptask_release_sharers(st, 0);
+		first = 0;
+		
+		ret = pscnv_bo_collect_sharers(cnk->bo, st->sharers,
+				&st->n_sharers, PSCNV_SWAPTASK_MAX_SHARERS);
+	}
+	
+	if (ret) {
+		for (i = first; i < st->n_sharers; i++) {
+			pscnv_client_unref(st->sharers[i]);
+		}
+		st->n_sharers = first;
+		
+		if (__ratelimit(&pscnv_swapping_sharers_ratelimit)) {
+			NV_ERROR(dev, "Swapping: %08x/%d-%u is shared with too "
+				"many clients, can not pause them all\n",
+				cnk->bo->cookie, cnk->bo->serial, cnk->idx);
+		}
+		return ret;
+	}
+	
+	for (i = first; i < st->n_sharers; i++) {
+		if (pscnv_swapping_debug >= 2) {
+			NV_INFO(dev, "Swapping: pausing client %d, which shares "
+				"%08x/%d with client %d\n", st->sharers[i]->pid,
+				cnk->bo->cookie, cnk->bo->serial, st->tgt->pid);
+		}
+		res = pscnv_client_pause_channels(st->sharers[i],
+						  &st->sharer_chans[i]);
+		if (res) {
+			ret = res;
+		}
+	}
+	
+	return ret;
+}
+
+static void
+pscnv_swaptask_continue_sharers(struct pscnv_swaptask *st)
+{
+	pscnv_swaptask_release_sharers(st, 0);
+}
+
 static void
 pscnv_swapping_swap_out(void *data, struct pscnv_client *cl)
 {
@@ -596,16 +930,30 @@ pscnv_swapping_swap_out(void *data, struct pscnv_client *cl)
 	dev_priv->last_mem_alloc_change_time = jiffies;
 	
 	for (i = 0; i < st->selected.size; i++) {
-		cnk = st->selected.chunks[i];
+		cnk = pscnv_swaptask_take_chunk(st, i);
+		if (!cnk) {
+			/* the BO has been freed */
+			continue;
+		}
 		
 		if (pscnv_chunk_expect_alloc_type(cnk, PSCNV_CHUNK_VRAM,
 						"pscnv_swapping_swap_out")) {
+			mutex_lock(&cl->lock);
+			atomic64_sub(pscnv_chunk_size(cnk), &cl->sysram_reserved);
+			mutex_unlock(&cl->lock);
 			continue;
 		}
 		
-		/* until now: one chunk after the other
-		 * increases swapped out counter and vram_demand (on fail) */
-		ret = pscnv_vram_to_host(cnk);
+		ret = pscnv_swaptask_pause_sharers(st, cnk);
+		if (ret) {
+			/* undo prepare_for_swap_out */
+			pscnv_bo_charge(cnk->bo, PSCNV_CHARGE_DEMAND,
+					pscnv_chunk_size(cnk));
+		} else {
+			/* until now: one chunk after the other
+			 * increases swapped out counter and vram_demand (on fail) */
+			ret = pscnv_vram_to_host(cnk);
+		}
 		if (ret) {
 			NV_ERROR(dev, "pscnv_swapping_swap_out: [client %d] vram_to_host"
 				" failed for chunk %08x/%d-%u\n", cl->pid,
@@ -613,15 +961,17 @@ pscnv_swapping_swap_out(void *data, struct pscnv_client *cl)
 			/* continue and try with next */
 		}
 
-		mutex_lock(&dev_priv->clients->lock);
-		pscnv_chunk_list_remove_unlocked(&cl->swap_pending, cnk);
+		mutex_lock(&cl->lock);
+		/* the SYSRAM has been allocated by now, or not at all */
+		atomic64_sub(pscnv_chunk_size(cnk), &cl->sysram_reserved);
+		pscnv_swap_pending_remove_unlocked(cl, cnk);
 		if (ret) {
 			/* failure, return to swapping_options */
 			pscnv_chunk_list_add_unlocked(&cl->swapping_options, cnk);
 		} else {
 			pscnv_chunk_list_add_unlocked(&cl->already_swapped, cnk);
 		}
-		mutex_unlock(&dev_priv->clients->lock);
+		mutex_unlock(&cl->lock);
 	}
 	
 	if (pscnv_swapping_debug >= 2) {
@@ -629,6 +979,10 @@ pscnv_swapping_swap_out(void *data, struct pscnv_client *cl)
 				cl->pid, st->serial);
 	}
 	
+	pscnv_swaptask_continue_sharers(st);
+	
+	pscnv_swapping_park_client(cl);
+	
 	complete(&st->completion);
 }
 
@@ -636,7 +990,6 @@ static void
 pscnv_swapping_swap_in(void *data, struct pscnv_client *cl)
 {
 	struct drm_device *dev = cl->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_swaptask *st = data;
 	struct pscnv_chunk *cnk;
 	int ret;
@@ -651,16 +1004,27 @@ pscnv_swapping_swap_in(void *data, struct pscnv_client *cl)
 	}
 	
 	for (i = 0; i < st->selected.size; i++) {
-		cnk = st->selected.chunks[i];
+		cnk = pscnv_swaptask_take_chunk(st, i);
+		if (!cnk) {
+			/* the BO has been freed */
+			continue;
+		}
 		
 		if (pscnv_chunk_expect_alloc_type(cnk, PSCNV_CHUNK_SYSRAM,
 						"pscnv_swapping_swap_in")) {
 			continue;
 		}
 		
-		/* until now: one chunk after the other, decreases swapped out
-		 * counter and vram_demand on fail */
-		ret = pscnv_vram_from_host(cnk);
+		ret = pscnv_swaptask_pause_sharers(st, cnk);
+		if (ret) {
+			/* undo prepare_for_swap_in */
+			pscnv_bo_charge(cnk->bo, PSCNV_CHARGE_DEMAND,
+					-(int64_t)pscnv_chunk_size(cnk));
+		} else {
+			/* until now: one chunk after the other, decreases
+			 * swapped out counter and vram_demand on fail */
+			ret = pscnv_vram_from_host(cnk);
+		}
 		if (ret) {
 			NV_ERROR(dev, "pscnv_swapping_swap_in: [client %d] vram_from_host"
 				" failed for chunk %08x/%d-%u\n", cl->pid,
@@ -668,15 +1032,15 @@ pscnv_swapping_swap_in(void *data, struct pscnv_client *cl)
 			/* continue and try with next */
 		}
 		
-		mutex_lock(&dev_priv->clients->lock);
-		pscnv_chunk_list_remove_unlocked(&cl->swap_pending, cnk);
+		mutex_lock(&cl->lock);
+		pscnv_swap_pending_remove_unlocked(cl, cnk);
 		if (ret) {
 			/* failure, return to already swapped */
 			pscnv_chunk_list_add_unlocked(&cl->already_swapped, cnk);
 		} else {
 			pscnv_chunk_list_add_unlocked(&cl->swapping_options, cnk);
 		}
-		mutex_unlock(&dev_priv->clients->lock);
+		mutex_unlock(&cl->lock);
 	}
 	
 	if (pscnv_swapping_debug >= 2) {
@@ -684,6 +1048,8 @@ pscnv_swapping_swap_in(void *data, struct pscnv_client *cl)
 				cl->pid, st->serial);
 	}
 	
+	pscnv_swaptask_continue_sharers(st);
+	
 	complete(&st->completion);
 }
 
@@ -693,23 +1059,23 @@ pscnv_swaptask_fire(struct list_head *swaptasks, client_workfunc_t func)
 	struct pscnv_swaptask *cur;
 	
 	list_for_each_entry(cur, swaptasks, list) {
+		mutex_lock(&cur->tgt->lock);
 		pscnv_client_do_on_empty_fifo_unlocked(cur->tgt, func, cur);
+		mutex_unlock(&cur->tgt->lock);
 	}
 }
 
 static void
 pscnv_swapping_add_bo_internal(struct pscnv_bo *bo)
 {
-	struct drm_device *dev = bo->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_client *cl = bo->client;
 	unsigned int i;
 	
-	mutex_lock(&dev_priv->clients->lock);
+	mutex_lock(&cl->lock);
 	for (i = 0; i < bo->n_chunks; i++) {
 		pscnv_chunk_list_add_unlocked(&cl->swapping_options, &bo->chunks[i]);
 	}
-	mutex_unlock(&dev_priv->clients->lock);
+	mutex_unlock(&cl->lock);
 }
 
 /* tell the swapping system about a bo that meight be swapped out */
@@ -754,58 +1120,60 @@ pscnv_swapping_add_bo(struct pscnv_bo *bo)
 static int
 pscnv_swapping_wait_for_pending_swaps(struct pscnv_bo *bo)
 {
-	struct drm_device *dev = bo->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	struct pscnv_client *cl = bo->client;
 	int res;
 	
-	const unsigned long timeout = jiffies + 2*HZ;
-	
-	while (pscnv_chunk_list_find_bo(&cl->swap_pending, bo) != -1) {
-		if (time_after(jiffies, timeout)) {
-			WARN_ON(1);
-			return -EBUSY;
-		}
-		
-		res = wait_for_completion_interruptible_timeout(
-			&dev_priv->swapping->next_swap, 2*HZ);
+	res = wait_event_interruptible_timeout(bo->swap_wq,
+			atomic_read(&bo->swaps_pending) == 0, 2*HZ);
 	
-		if (res == -ERESTARTSYS) {
-			/* RESTARTSYS => interrupt */
-			return res;
-		}
-		if (res == 0) {
-			/* timout */
-			WARN_ON_ONCE(1);
-			return -EBUSY;
-		}
+	if (res == -ERESTARTSYS) {
+		/* RESTARTSYS => interrupt */
+		return res;
+	}
+	if (res == 0) {
+		/* timout */
+		WARN_ON_ONCE(1);
+		return -EBUSY;
 	}
 	
 	return 0;
 }
 
-static int
-pscnv_swapping_remove_bo_internal(struct pscnv_bo *bo)
+void
+pscnv_swapping_cancel_bo(struct pscnv_bo *bo)
 {
-	struct drm_device *dev = bo->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	struct pscnv_client *cl = bo->client;
-	int res;
 	
-	/* should catch most chunks */
-	mutex_lock(&dev_priv->clients->lock);
-	pscnv_chunk_list_remove_bo_unlocked(&cl->swapping_options, bo);
-	pscnv_chunk_list_remove_bo_unlocked(&cl->already_swapped, bo);
-	mutex_unlock(&dev_priv->clients->lock);
+	if (!cl) {
+		return;
+	}
+	
+	mutex_lock(&cl->lock);
+	pscnv_chunk_list_remove_bo_unlocked(&cl->swapping_options, bo);
+	pscnv_chunk_list_remove_bo_unlocked(&cl->already_swapped, bo);
+	
+	/* copies that did not start yet would be thrown away anyway */
+	pscnv_swaptask_cancel_bo_unlocked(bo);
+	mutex_unlock(&cl->lock);
+}
+
+static int
+pscnv_swapping_remove_bo_internal(struct pscnv_bo *bo)
+{
+	struct pscnv_client *cl = bo->client;
+	int res;
+	
+	/* should catch most chunks */
+	pscnv_swapping_cancel_bo(bo);
 	
-	/* wait for any remaining chunk to be moved into one of the other lists*/	
+	/* wait for the copies that are already in flight to be moved into one
+	 * of the other lists */
 	res = pscnv_swapping_wait_for_pending_swaps(bo);
 	
 	/* catch the rest */
-	mutex_lock(&dev_priv->clients->lock);
+	mutex_lock(&cl->lock);
 	pscnv_chunk_list_remove_bo_unlocked(&cl->swapping_options, bo);
 	pscnv_chunk_list_remove_bo_unlocked(&cl->already_swapped, bo);
-	mutex_unlock(&dev_priv->clients->lock);
+	mutex_unlock(&cl->lock);
 
 	return res;
 
@@ -881,6 +1249,16 @@ pscnv_swapping_sysram_fallback_unlocked(struct pscnv_chunk *cnk, bool prepare_sw
 		return -EINVAL;
 	}
 	
+	if (!pscnv_client_host_quota_ok(cl, cnk_size)) {
+		if (pscnv_swapping_debug >= 1) {
+			NV_INFO(dev, "Swapping: client %s exceeds its limit of "
+				"%dMiB, not allocating chunk %08x/%d-%u\n",
+				cl->comm, pscnv_swap_client_limit,
+				cnk->bo->cookie, cnk->bo->serial, cnk->idx);
+		}
+		return -ENOMEM;
+	}
+	
 	cnk->flags |= PSCNV_CHUNK_SWAPPED;
 	
 	/* update vram_swapped */
@@ -905,9 +1283,7 @@ pscnv_swapping_sysram_fallback_unlocked(struct pscnv_chunk *cnk, bool prepare_sw
 		}
 	}
 	
-	if (cl) {
-		atomic64_sub(cnk_size, &cl->vram_demand);
-	}
+	pscnv_bo_charge(bo, PSCNV_CHARGE_DEMAND, -(int64_t)cnk_size);
 	
 	return ret;
 }
@@ -935,19 +1311,21 @@ pscnv_swapping_prepare_for_swap_out_unlocked(uint64_t *will_free, struct list_he
 	switch (cnk->alloc_type) {
 	case PSCNV_CHUNK_UNALLOCATED:
 		ret = pscnv_swapping_sysram_fallback_unlocked(cnk, true);
-		if (!ret)
+		if (!ret) {
 			*will_free += cnk_size;
+			pscnv_client_pressure_event_unlocked(cl, PSCNV_PRESSURE_EVICT);
+		}
 		
 		return ret;
 	
 	case PSCNV_CHUNK_VRAM:
-		pscnv_chunk_list_add_unlocked(&cl->swap_pending, cnk);
+		pscnv_swap_pending_add_unlocked(cl, cnk);
 		st = pscnv_swaptask_add_chunk_unlocked(swaptasks, cnk);
 		if (!st) {
 			NV_ERROR(dev, "pscnv_swapping_prepare: failed to add "
 					"chunk %08x/%d-%u\n", cnk->bo->cookie,
 					cnk->bo->serial, cnk->idx);
-			pscnv_chunk_list_remove_unlocked(&cl->swap_pending, cnk);
+			pscnv_swap_pending_remove_unlocked(cl, cnk);
 			return -EBUSY;
 		}
 		if (st && pscnv_swapping_debug >= 1) {
@@ -957,9 +1335,15 @@ pscnv_swapping_prepare_for_swap_out_unlocked(uint64_t *will_free, struct list_he
 				size_str, cl->pid, st->serial);
 		}
 		
-		atomic64_sub(cnk_size, &cl->vram_demand);
+		pscnv_bo_charge(bo, PSCNV_CHARGE_DEMAND, -(int64_t)cnk_size);
 		*will_free += cnk_size;
 		
+		/* the SYSRAM is only allocated when the swaptask runs, keep
+		 * others from promising it to this client in the meantime */
+		atomic64_add(cnk_size, &cl->sysram_reserved);
+		
+		pscnv_client_pressure_event_unlocked(cl, PSCNV_PRESSURE_EVICT);
+		
 		return 0;
 	
 	default:
@@ -996,13 +1380,13 @@ pscnv_swapping_prepare_for_swap_in_unlocked(struct list_head *swaptasks, struct
 		return -EINVAL;
 	}
 	
-	pscnv_chunk_list_add_unlocked(&cl->swap_pending, cnk);
+	pscnv_swap_pending_add_unlocked(cl, cnk);
 	st = pscnv_swaptask_add_chunk_unlocked(swaptasks, cnk);
 	if (!st) {
 		NV_ERROR(dev, "pscnv_swapping_prepare: failed to add "
 				"chunk %08x/%d-%u\n", cnk->bo->cookie,
 				cnk->bo->serial, cnk->idx);
-		pscnv_chunk_list_remove_unlocked(&cl->swap_pending, cnk);
+		pscnv_swap_pending_remove_unlocked(cl, cnk);
 		return -EBUSY;
 	}
 	if (st && pscnv_swapping_debug >= 1) {
@@ -1012,7 +1396,7 @@ pscnv_swapping_prepare_for_swap_in_unlocked(struct list_head *swaptasks, struct
 			size_str, cl->pid, st->serial);
 	}
 	
-	atomic64_add(cnk_size, &cl->vram_demand);
+	pscnv_bo_charge(cnk->bo, PSCNV_CHARGE_DEMAND, cnk_size);
 		
 	return 0;
 }
@@ -1023,7 +1407,7 @@ pscnv_swapping_mem_avail_unlocked(struct drm_device *dev)
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	
 	int64_t vram_usage = pscnv_mem_vram_usage_effective_unlocked(dev);
-	int64_t vram_demand = pscnv_clients_vram_demand_unlocked(dev);
+	int64_t vram_demand = pscnv_clients_vram_demand(dev);
 	int64_t vram_limit = dev_priv->vram_limit;
 	
 	return vram_limit - max(vram_usage, vram_demand);
@@ -1042,6 +1426,172 @@ pscnv_swapping_mem_avail(struct drm_device *dev)
 	return res;
 }
 
+/* VRAM that may be distributed among the clients. Without a vram_limit, all
+ * VRAM that is not reserved for the driver counts */
+static int64_t
+pscnv_swapping_vram_budget_total_unlocked(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+
+	int64_t vram_usage = pscnv_clients_vram_usage(dev);
+	int64_t vram_usage_eff = pscnv_mem_vram_usage_effective_unlocked(dev);
+	int64_t total;
+
+	if (dev_priv->vram_limit) {
+		total = dev_priv->vram_limit;
+	} else {
+		total = dev_priv->vram_size - PSCNV_VRAM_RESERVED;
+	}
+
+	/* the kernel may use more than its reserved amount of VRAM */
+	return total - (vram_usage_eff - vram_usage);
+}
+
+/* the victim selection always takes memory away from the client with the
+ * highest demand. So if the demand of all clients exceeds the budget, each
+ * client may keep up to a common "water level", which is calculated here.
+ * Clients that demand less than this level keep all their memory.
+ *
+ * Returns false, if the demand of all clients can be satisfied. In this case
+ * *level is what is left after that */
+static bool
+pscnv_swapping_vram_level_unlocked(struct drm_device *dev, int64_t *level)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_clients *clients = dev_priv->clients;
+	struct pscnv_client *cur;
+	struct rb_node *node;
+	int64_t total = pscnv_swapping_vram_budget_total_unlocked(dev);
+	int64_t small_sum = 0;
+	int n_big = clients->n_clients;
+
+	if (total <= 0) {
+		*level = 0;
+		return true;
+	}
+
+	/* going up from the smallest demand, every client that fits below
+	 * the level of the remaining ones keeps all its memory and leaves
+	 * more for the others */
+	pscnv_clients_sort_unlocked(dev);
+	for (node = rb_first(&clients->by_demand); node; node = rb_next(node)) {
+		cur = rb_entry(node, struct pscnv_client, demand_node);
+		*level = div_s64(total - small_sum, n_big);
+		if ((int64_t)cur->demand_key > *level) {
+			return true;
+		}
+		small_sum += cur->demand_key;
+		n_big--;
+	}
+
+	*level = max_t(int64_t, total - small_sum, 0);
+	return false;
+}
+
+static uint64_t
+pscnv_swapping_vram_share_common(struct pscnv_client *me, int64_t level, bool pressure)
+{
+	if (pressure) {
+		return level;
+	}
+	
+	/* everyone may additionally take what is left */
+	return level + (me ? atomic64_read(&me->vram_demand) : 0);
+}
+
+static uint64_t
+pscnv_swapping_vram_share_unlocked(struct drm_device *dev, struct pscnv_client *me)
+{
+	int64_t level;
+	bool pressure = pscnv_swapping_vram_level_unlocked(dev, &level);
+	
+	return pscnv_swapping_vram_share_common(me, level, pressure);
+}
+
+void
+pscnv_swapping_vram_budget(struct drm_device *dev, struct pscnv_client *cl,
+				struct drm_pscnv_vram_budget *budget)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int64_t total, used;
+
+	mutex_lock(&dev_priv->clients->lock);
+
+	if (cl) {
+		budget->vram_usage = atomic64_read(&cl->vram_usage);
+		budget->vram_swapped = atomic64_read(&cl->vram_swapped);
+		budget->vram_demand = atomic64_read(&cl->vram_demand);
+	} else {
+		budget->vram_usage = 0;
+		budget->vram_swapped = 0;
+		budget->vram_demand = 0;
+	}
+
+	budget->vram_share = pscnv_swapping_vram_share_unlocked(dev, cl);
+
+	total = pscnv_swapping_vram_budget_total_unlocked(dev);
+	used = max_t(int64_t, pscnv_clients_vram_usage(dev),
+			      pscnv_clients_vram_demand(dev));
+	budget->vram_free = max_t(int64_t, total - used, 0);
+
+	mutex_unlock(&dev_priv->clients->lock);
+}
+
+/* tell all clients that asked for it, if their share got smaller since the
+ * last check */
+static void
+pscnv_swapping_check_shares_unlocked(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_client *cur;
+	uint64_t share;
+	int64_t level;
+	bool pressure;
+	
+	/* the level is the same for everybody, so calculate it only once */
+	pressure = pscnv_swapping_vram_level_unlocked(dev, &level);
+	
+	list_for_each_entry(cur, &dev_priv->clients->list, clients) {
+		if (!(cur->pressure_mask & PSCNV_PRESSURE_SHARE_SHRINK)) {
+			continue;
+		}
+		
+		share = pscnv_swapping_vram_share_common(cur, level, pressure);
+		if (cur->pressure_share && share < cur->pressure_share) {
+			pscnv_client_pressure_event_unlocked(cur,
+					PSCNV_PRESSURE_SHARE_SHRINK);
+		}
+		cur->pressure_share = share;
+	}
+}
+
+/* tell all clients that asked for it, when free VRAM becomes available after
+ * a period of memory pressure */
+static void
+pscnv_swapping_check_headroom(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_swapping *swapping = dev_priv->swapping;
+	struct pscnv_client *cur;
+	bool headroom;
+	
+	mutex_lock(&dev_priv->clients->lock);
+	
+	headroom = pscnv_swapping_mem_avail_unlocked(dev) > PSCNV_INCREASE_THRESHOLD;
+	
+	if (headroom && !swapping->headroom) {
+		list_for_each_entry(cur, &dev_priv->clients->list, clients) {
+			pscnv_client_pressure_event_unlocked(cur,
+					PSCNV_PRESSURE_HEADROOM);
+		}
+	}
+	swapping->headroom = headroom;
+	
+	pscnv_swapping_check_shares_unlocked(dev);
+	
+	mutex_unlock(&dev_priv->clients->lock);
+}
+
 static void
 pscnv_swapping_reduce_vram_of_client_unlocked(struct pscnv_client *victim, uint64_t *will_free, struct list_head *swaptasks)
 {
@@ -1051,10 +1601,31 @@ pscnv_swapping_reduce_vram_of_client_unlocked(struct pscnv_client *victim, uint6
 	struct pscnv_chunk *cnk;
 	int ops = 0;
 	
+	mutex_lock(&victim->lock);
 	while (pscnv_swapping_mem_avail_unlocked(dev) < 0 &&
 		ops < PSCNV_SWAPPING_OPS_PER_VICTIM && 
 		(cnk = pscnv_chunk_list_take_random_unlocked(&victim->swapping_options))) {
 		
+		if (pscnv_bo_count_sharers(cnk->bo) > PSCNV_SWAPTASK_MAX_SHARERS) {
+			/* a swaptask could not pause all users of this chunk,
+			 * so skip it for now. It becomes an option again as
+			 * soon as enough sharers are gone */
+			if (pscnv_swapping_debug >= 1) {
+				NV_INFO(dev, "Swapping: %08x/%d-%u is shared with "
+					"too many clients, not swapping it\n",
+					cnk->bo->cookie, cnk->bo->serial, cnk->idx);
+			}
+			pscnv_chunk_list_add_unlocked(&victim->swapping_options, cnk);
+			ops++;
+			continue;
+		}
+		
+		if (!pscnv_client_host_quota_ok(victim, pscnv_chunk_size(cnk))) {
+			/* victim has used up its host memory */
+			pscnv_chunk_list_add_unlocked(&victim->swapping_options, cnk);
+			break;
+		}
+		
 		ret = pscnv_swapping_prepare_for_swap_out_unlocked(
 			will_free, swaptasks, cnk);
 		
@@ -1070,9 +1641,11 @@ pscnv_swapping_reduce_vram_of_client_unlocked(struct pscnv_client *victim, uint6
 		
 		ops++;
 	}
+	mutex_unlock(&victim->lock);
 }
 
-static void
+/* returns the number of chunks that have been queued for swap-in */
+static int
 pscnv_swapping_increase_vram_of_client_unlocked(struct pscnv_client *winner, struct list_head *swaptasks)
 {
 	struct drm_device *dev = winner->dev;
@@ -1080,25 +1653,24 @@ pscnv_swapping_increase_vram_of_client_unlocked(struct pscnv_client *winner, str
 	
 	struct pscnv_chunk *cnk;
 	int ops = 0;
+	int queued = 0;
 	
-	while (ops < PSCNV_SWAPPING_OPS_PER_VICTIM &&
-		(cnk = pscnv_chunk_list_take_random_unlocked(&winner->already_swapped))) {
-		
-		uint64_t mem_avail = pscnv_swapping_mem_avail_unlocked(dev);
-
-		if (pscnv_chunk_expect_alloc_type(cnk, PSCNV_CHUNK_SYSRAM,
-				"pscnv_swapping_increase_vram_of_client")) {
-			
-			pscnv_chunk_list_add_unlocked(&winner->already_swapped, cnk);
-			ops++;
-			continue;
+	int64_t mem_avail;
+	
+	mutex_lock(&winner->lock);
+	while (ops < PSCNV_SWAPPING_OPS_PER_VICTIM) {
+		mem_avail = pscnv_swapping_mem_avail_unlocked(dev);
+		if (mem_avail <= 0) {
+			break;
 		}
 		
-		if (pscnv_chunk_size(cnk) > mem_avail) {
-			/* not enough free space for this chunk */
-			pscnv_chunk_list_add_unlocked(&winner->already_swapped, cnk);
-			ops++;
-			continue;
+		/* parked chunks are skipped, the client is idle and gets
+		 * unparked before any of its channels runs again */
+		cnk = pscnv_chunk_list_take_best_unlocked(&winner->already_swapped,
+							  mem_avail);
+		if (!cnk) {
+			/* nothing that fits into the free space */
+			break;
 		}
 		
 		ret = pscnv_swapping_prepare_for_swap_in_unlocked(swaptasks, cnk);
@@ -1109,46 +1681,85 @@ pscnv_swapping_increase_vram_of_client_unlocked(struct pscnv_client *winner, str
 			NV_ERROR(dev, "failed to prepare chunk %08x/%d-%u for "
 				"swap-In. ret = %d\n", cnk->bo->cookie,
 				cnk->bo->serial, cnk->idx, ret);
+		} else {
+			queued++;
 		}
 		
 		ops++;	
 	}
+	mutex_unlock(&winner->lock);
+	
+	return queued;
 }
 
+/* clients are kept sorted by demand, so this usually only has to look at
+ * the last one or few of them */
 static struct pscnv_client*
 pscnv_swapping_choose_victim_unlocked(struct drm_device *dev)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
-	struct pscnv_client *cur, *victim = NULL;
-	uint64_t cur_demand;
-	uint64_t max = 0;
+	struct pscnv_client *cur;
+	struct rb_node *node;
 	
-	list_for_each_entry(cur, &dev_priv->clients->list, clients) {
-		cur_demand = atomic64_read(&cur->vram_demand);
-		if (cur_demand > max &&
-		    !pscnv_chunk_list_empty(&cur->swapping_options)) {
-			victim = cur;
-			max = cur_demand;
+	pscnv_clients_sort_unlocked(dev);
+	
+	for (node = rb_last(&dev_priv->clients->by_demand); node; node = rb_prev(node)) {
+		cur = rb_entry(node, struct pscnv_client, demand_node);
+		if (cur->demand_key == 0) {
+			break;
+		}
+		if (!pscnv_chunk_list_empty(&cur->swapping_options) &&
+		    pscnv_client_host_quota_ok(cur, dev_priv->chunk_size)) {
+			return cur;
 		}
 	}
 	
-	return victim;
+	return NULL;
+}
+
+/* true, if any of the swapped chunks of cl could be swapped in right away.
+ * Called with clients->lock held */
+static bool
+pscnv_swapping_has_swapped_sysram(struct pscnv_client *cl)
+{
+	bool res;
+	
+	mutex_lock(&cl->lock);
+	res = pscnv_chunk_list_has_sysram_unlocked(&cl->already_swapped);
+	mutex_unlock(&cl->lock);
+	
+	return res;
 }
 
 static struct pscnv_client*
 pscnv_swapping_choose_winner_unlocked(struct drm_device *dev)
 {
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_clients *clients = dev_priv->clients;
 	struct pscnv_client *cur, *winner = NULL;
-	uint64_t cur_demand;
-	uint64_t min = ((uint64_t)~0ULL);
+	struct rb_node *node;
 	
-	list_for_each_entry(cur, &dev_priv->clients->list, clients) {
-		cur_demand = atomic64_read(&cur->vram_demand);
-		if (cur_demand < min &&
-		    !pscnv_chunk_list_empty(&cur->already_swapped)) {
+	pscnv_clients_sort_unlocked(dev);
+	
+	for (node = rb_first(&clients->by_demand); node; node = rb_next(node)) {
+		cur = rb_entry(node, struct pscnv_client, demand_node);
+		
+		if (pscnv_chunk_list_empty(&cur->already_swapped)) {
+			pscnv_client_set_resumed_unlocked(cur, false);
+		} else if (cur->swapin_skip_run == dev_priv->swapping->swapin_run) {
+			/* got nothing back earlier in this run */
+		} else if (!pscnv_swapping_has_swapped_sysram(cur)) {
+			/* only parked chunks, they come back on unpark */
+		} else if (cur->resumed) {
+			/* clients that just started submitting again go first */
+			return cur;
+		} else if (!winner) {
 			winner = cur;
-			min = cur_demand;
+		}
+		
+		/* otherwise, the one with the smallest demand wins */
+		if (winner && clients->n_resumed == 0) {
+			break;
 		}
 	}
 	
@@ -1183,6 +1794,9 @@ pscnv_swapping_reduce_vram(struct drm_device *dev, struct pscnv_client *me)
 		ops++;
 	}
 	
+	dev_priv->swapping->headroom = false;
+	pscnv_swapping_check_shares_unlocked(dev);
+	
 	mutex_unlock(&dev_priv->clients->lock);
 	
 	if (pscnv_swapping_mem_avail(dev) < 0) {
@@ -1197,9 +1811,6 @@ pscnv_swapping_reduce_vram(struct drm_device *dev, struct pscnv_client *me)
 	
 	pscnv_swaptask_fire(&swaptasks, pscnv_swapping_swap_out);
 	
-	complete_all(&dev_priv->swapping->next_swap);
-	INIT_COMPLETION(dev_priv->swapping->next_swap);
-	
 	ret = pscnv_swaptask_wait_for_completions(dev, __func__, &swaptasks);
 	
 	getnstimeofday(&end);
@@ -1236,10 +1847,15 @@ pscnv_swapping_increase_vram(struct drm_device *dev)
 	
 	mutex_lock(&dev_priv->clients->lock);
 	
+	dev_priv->swapping->swapin_run++;
+	
 	while (ops < PSCNV_SWAPPING_MAXOPS &&
 		(winner = pscnv_swapping_choose_winner_unlocked(dev))) {
 		
-		pscnv_swapping_increase_vram_of_client_unlocked(winner, &swaptasks);
+		if (!pscnv_swapping_increase_vram_of_client_unlocked(winner, &swaptasks)) {
+			/* none of its chunks fit, let the others have a go */
+			winner->swapin_skip_run = dev_priv->swapping->swapin_run;
+		}
 		
 		ops++;
 	}
@@ -1248,13 +1864,457 @@ pscnv_swapping_increase_vram(struct drm_device *dev)
 	
 	pscnv_swaptask_fire(&swaptasks, pscnv_swapping_swap_in);
 	
-	complete_all(&dev_priv->swapping->next_swap);
-	INIT_COMPLETION(dev_priv->swapping->next_swap);
+	return 0;
+}
+
+
+
+/* sample the IB_PUT of all channels of clients with swapped chunks. If a
+ * client that has been idle submits new work, give its chunks back right
+ * away instead of waiting for the next increase_vram_work */
+static void
+pscnv_swapping_sample_activity(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_client *cur;
+	struct pscnv_chan *ch;
+	uint32_t ib_put;
+	bool active;
+	bool trigger = false;
+	bool wake = false;
+	
+	mutex_lock(&dev_priv->clients->lock);
+	list_for_each_entry(cur, &dev_priv->clients->list, clients) {
+		active = false;
+		
+		list_for_each_entry(ch, &cur->channels, client_list) {
+			if (pscnv_chan_get_state(ch) != PSCNV_CHAN_RUNNING &&
+			    pscnv_chan_get_state(ch) != PSCNV_CHAN_PAUSED) {
+				continue;
+			}
+			ib_put = dev_priv->chan->read_ib_put(ch);
+			if (ib_put != ch->last_ib_put) {
+				ch->last_ib_put = ib_put;
+				ch->last_active = jiffies;
+				active = true;
+				/* racy read, pscnv_chan_evict_idle checks
+				 * again under evict_lock */
+				wake |= ch->idle_paused;
+			}
+		}
+		
+		if (active && !cur->submitting &&
+		    !pscnv_chunk_list_empty(&cur->already_swapped)) {
+			if (pscnv_swapping_debug >= 1) {
+				NV_INFO(dev, "Swapping: client %d resumed "
+					"submission with %lld bytes swapped\n",
+					cur->pid, atomic64_read(&cur->vram_swapped));
+			}
+			pscnv_client_set_resumed_unlocked(cur, true);
+			trigger = true;
+		}
+		if (!active) {
+			pscnv_client_set_resumed_unlocked(cur, false);
+		}
+		cur->submitting = active;
+	}
+	mutex_unlock(&dev_priv->clients->lock);
+	
+	if (trigger) {
+		pscnv_swapping_increase_vram(dev);
+	}
+	
+	if (wake) {
+		pscnv_chan_evict_idle(dev);
+	}
+}
+
+static void
+activity_work_func(struct work_struct *work)
+{
+	struct delayed_work *dwork =
+		container_of(work, struct delayed_work, work);
+	struct pscnv_swapping *swapping = 
+		container_of(dwork, struct pscnv_swapping, activity_work);
+	struct drm_device *dev = swapping->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	
+	/* the channel engine comes up after the swapping code. Idle channels
+	 * are only detected by sampling, too */
+	if (dev_priv->chan && dev_priv->chan->read_ib_put &&
+	    (pscnv_clients_vram_swapped(dev) > 0 || pscnv_swap_ctx_delay)) {
+		pscnv_swapping_sample_activity(dev);
+	}
+	
+	pscnv_swapping_schedule_activity(swapping);
+}
+
+/*******************************************************************************
+ * SWAPSTORE
+ ******************************************************************************/
+
+/* put chunks that have been (un-)parked back to the already_swapped list of
+ * their client and wake up everyone who waits for them */
+static void
+pscnv_swapping_park_done(struct drm_device *dev, struct pscnv_chunk **cnks, int n)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_client *cl;
+	int i;
+	
+	for (i = 0; i < n; i++) {
+		cl = cnks[i]->bo->client;
+		mutex_lock(&cl->lock);
+		pscnv_swap_pending_remove_unlocked(cl, cnks[i]);
+		pscnv_chunk_list_add_unlocked(&cl->already_swapped, cnks[i]);
+		atomic_dec(&cl->parking);
+		mutex_unlock(&cl->lock);
+	}
+	
+	wake_up_all(&dev_priv->swapstore->wq);
+}
+
+/* a client is idle, if none of its channels may run. Channels paused by
+ * pscnv_chan_evict_idle() stay paused until their client has been unparked.
+ * Called with clients->lock and the lock of cl held, the latter orders the
+ * check against pscnv_swapping_unpark() */
+static bool
+pscnv_swapping_client_idle_unlocked(struct pscnv_client *cl)
+{
+	struct pscnv_chan *ch;
+	
+	list_for_each_entry(ch, &cl->channels, client_list) {
+		if (!ch->idle_paused) {
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+/* take up to max parkable chunks of cl out of its already_swapped list, if
+ * cl is idle. Called with clients->lock and the lock of cl held */
+static int
+pscnv_swapping_take_parkable_unlocked(struct pscnv_client *cl,
+				      struct pscnv_chunk **cnks, int max)
+{
+	struct pscnv_chunk *cnk;
+	size_t i;
+	int n = 0;
+	
+	if (!pscnv_swapping_client_idle_unlocked(cl)) {
+		/* the GPU may access the swapped chunks */
+		return 0;
+	}
+	
+	for (i = 0; i < cl->already_swapped.size && n < max; ) {
+		cnk = cl->already_swapped.chunks[i];
+		if (!pscnv_swapstore_chunk_parkable(cnk)) {
+			i++;
+			continue;
+		}
+		
+		/* take_unlocked moves the last chunk to position i */
+		pscnv_chunk_list_take_unlocked(&cl->already_swapped, i);
+		pscnv_swap_pending_add_unlocked(cl, cnk);
+		atomic_inc(&cl->parking);
+		cnks[n++] = cnk;
+	}
+	
+	return n;
+}
+
+static void
+pscnv_swapping_park_chunks(struct drm_device *dev, struct pscnv_chunk **cnks, int n)
+{
+	int i;
+	int ret;
+	
+	if (n == 0) {
+		return;
+	}
+	
+	for (i = 0; i < n; i++) {
+		ret = pscnv_swapstore_park_chunk(cnks[i]);
+		if (ret) {
+			NV_ERROR(dev, "pscnv_swapping_park: failed to park chunk "
+				"%08x/%d-%u, ret = %d\n", cnks[i]->bo->cookie,
+				cnks[i]->bo->serial, cnks[i]->idx, ret);
+		}
+	}
+	
+	pscnv_swapping_park_done(dev, cnks, n);
+}
+
+/* move swapped chunks of idle clients into the swapstore */
+static void
+pscnv_swapping_park_idle_clients(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_chunk *cnks[PSCNV_SWAPSTORE_PARK_PER_RUN];
+	struct pscnv_client *cur;
+	int n = 0;
+	
+	mutex_lock(&dev_priv->clients->lock);
+	list_for_each_entry(cur, &dev_priv->clients->list, clients) {
+		mutex_lock(&cur->lock);
+		n += pscnv_swapping_take_parkable_unlocked(cur, cnks + n,
+				PSCNV_SWAPSTORE_PARK_PER_RUN - n);
+		mutex_unlock(&cur->lock);
+	}
+	mutex_unlock(&dev_priv->clients->lock);
+	
+	pscnv_swapping_park_chunks(dev, cnks, n);
+}
+
+/* park the chunks of an idle client right after they have been swapped out,
+ * instead of waiting for pscnv_swapping_park_idle_clients. This way, equal
+ * contents get shared in the swapstore as soon as possible */
+static void
+pscnv_swapping_park_client(struct pscnv_client *cl)
+{
+	struct drm_device *dev = cl->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_chunk *cnks[PSCNV_SWAPSTORE_PARK_PER_RUN];
+	int n;
+	
+	if (!dev_priv->swapstore) {
+		return;
+	}
+	
+	do {
+		mutex_lock(&dev_priv->clients->lock);
+		mutex_lock(&cl->lock);
+		n = pscnv_swapping_take_parkable_unlocked(cl, cnks,
+				PSCNV_SWAPSTORE_PARK_PER_RUN);
+		mutex_unlock(&cl->lock);
+		mutex_unlock(&dev_priv->clients->lock);
+		
+		pscnv_swapping_park_chunks(dev, cnks, n);
+	} while (n == PSCNV_SWAPSTORE_PARK_PER_RUN);
+}
+
+/* get all parked chunks of cl (bo == NULL) or of bo back into SYSRAM */
+static void
+pscnv_swapping_unpark(struct pscnv_client *cl, struct pscnv_bo *bo)
+{
+	struct drm_device *dev = cl->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_chunk *cnks[PSCNV_SWAPSTORE_PARK_PER_RUN];
+	struct pscnv_chunk *cnk;
+	size_t i;
+	int n, done;
+	bool busy;
+	int ret;
+	
+	if (!dev_priv->swapstore) {
+		return;
+	}
+	
+	do {
+		/* chunks of cl that are currently being parked are in none
+		 * of the lists */
+		wait_event(dev_priv->swapstore->wq,
+				atomic_read(&cl->parking) == 0);
+		
+		n = 0;
+		done = 0;
+		
+		mutex_lock(&cl->lock);
+		for (i = 0; i < cl->already_swapped.size &&
+				n < PSCNV_SWAPSTORE_PARK_PER_RUN; ) {
+			cnk = cl->already_swapped.chunks[i];
+			if (cnk->alloc_type != PSCNV_CHUNK_SWAPSTORE ||
+			    (bo && cnk->bo != bo)) {
+				i++;
+				continue;
+			}
+			
+			pscnv_chunk_list_take_unlocked(&cl->already_swapped, i);
+			pscnv_swap_pending_add_unlocked(cl, cnk);
+			atomic_inc(&cl->parking);
+			cnks[n++] = cnk;
+		}
+		/* parking may have started after the wait above, if the
+		 * client was still idle back then. Wait for it again */
+		busy = atomic_read(&cl->parking) > n;
+		mutex_unlock(&cl->lock);
+		
+		if (n == 0) {
+			continue;
+		}
+		
+		for (i = 0; i < n; i++) {
+			ret = pscnv_swapstore_unpark_chunk(cnks[i]);
+			if (ret) {
+				NV_ERROR(dev, "pscnv_swapping_unpark: failed to "
+					"unpark chunk %08x/%d-%u, ret = %d\n",
+					cnks[i]->bo->cookie, cnks[i]->bo->serial,
+					cnks[i]->idx, ret);
+			} else {
+				done++;
+			}
+		}
+		
+		pscnv_swapping_park_done(dev, cnks, n);
+		
+	} while ((n == PSCNV_SWAPSTORE_PARK_PER_RUN && done > 0) || busy);
+}
+
+void
+pscnv_swapping_unpark_client(struct pscnv_client *cl)
+{
+	pscnv_swapping_unpark(cl, NULL);
+}
+
+void
+pscnv_swapping_unpark_bo(struct pscnv_bo *bo)
+{
+	if (!bo->client) {
+		return;
+	}
+	
+	pscnv_swapping_unpark(bo->client, bo);
+}
+
+/* put the chunks of bo back into the list that matches where they are */
+static void
+pscnv_swapping_readd_bo(struct pscnv_bo *bo)
+{
+	struct pscnv_client *cl = bo->client;
+	struct pscnv_chunk *cnk;
+	uint32_t i;
+	
+	mutex_lock(&cl->lock);
+	for (i = 0; i < bo->n_chunks; i++) {
+		cnk = &bo->chunks[i];
+		if (cnk->flags & PSCNV_CHUNK_SWAPPED) {
+			pscnv_chunk_list_add_unlocked(&cl->already_swapped, cnk);
+		} else {
+			pscnv_chunk_list_add_unlocked(&cl->swapping_options, cnk);
+		}
+	}
+	mutex_unlock(&cl->lock);
+}
+
+int
+pscnv_swapping_pin_bo(struct pscnv_bo *bo)
+{
+	struct drm_device *dev = bo->dev;
+	struct pscnv_client *cl = bo->client;
+	struct pscnv_chunk *cnk;
+	uint32_t i;
+	int ret = 0;
+	
+	LIST_HEAD(swaptasks);
+	
+	if (!cl) {
+		return 0;
+	}
+	
+	/* parked chunks come back through SYSRAM */
+	pscnv_swapping_unpark_bo(bo);
+	
+	mutex_lock(&cl->lock);
+	for (i = 0; i < bo->n_chunks; i++) {
+		cnk = &bo->chunks[i];
+		if (cnk->list != &cl->already_swapped) {
+			continue;
+		}
+		pscnv_chunk_list_remove_unlocked(&cl->already_swapped, cnk);
+		ret = pscnv_swapping_prepare_for_swap_in_unlocked(&swaptasks, cnk);
+		if (ret) {
+			pscnv_chunk_list_add_unlocked(&cl->already_swapped, cnk);
+			break;
+		}
+	}
+	mutex_unlock(&cl->lock);
+	
+	/* the swaptask pauses the client and the sharers of bo while the
+	 * chunks are copied */
+	pscnv_swaptask_fire(&swaptasks, pscnv_swapping_swap_in);
+	if (!list_empty(&swaptasks)) {
+		int res = pscnv_swaptask_wait_for_completions(dev, __func__, &swaptasks);
+		ret = ret ? ret : res;
+	}
+	if (ret) {
+		return ret;
+	}
+	
+	ret = pscnv_swapping_remove_bo(bo);
+	if (ret) {
+		pscnv_swapping_readd_bo(bo);
+		return ret;
+	}
+	
+	/* some chunks may have been swapped out again in the meantime, or
+	 * there was no VRAM for them */
+	for (i = 0; i < bo->n_chunks; i++) {
+		if (bo->chunks[i].flags & PSCNV_CHUNK_SWAPPED) {
+			NV_INFO(dev, "pscnv_swapping_pin_bo: %08x/%d-%u is still "
+				"swapped, can not pin the BO\n",
+				bo->cookie, bo->serial, i);
+			pscnv_swapping_readd_bo(bo);
+			return -ENOMEM;
+		}
+	}
 	
 	return 0;
 }
 
+int
+pscnv_swapping_evict_bo(struct pscnv_bo *bo)
+{
+	struct drm_device *dev = bo->dev;
+	uint32_t i;
+	int ret;
+	
+	WARN_ON(bo->client);
+	
+	for (i = 0; i < bo->n_chunks; i++) {
+		struct pscnv_chunk *cnk = &bo->chunks[i];
+		
+		if (cnk->alloc_type != PSCNV_CHUNK_VRAM) {
+			continue;
+		}
+		
+		ret = pscnv_vram_to_host(cnk);
+		if (ret) {
+			NV_ERROR(dev, "pscnv_swapping_evict_bo: failed to evict "
+				"%08x/%d-%u\n", bo->cookie, bo->serial, cnk->idx);
+			return ret;
+		}
+	}
+	
+	return 0;
+}
 
+int
+pscnv_swapping_restore_bo(struct pscnv_bo *bo)
+{
+	struct drm_device *dev = bo->dev;
+	uint32_t i;
+	int ret;
+	
+	for (i = 0; i < bo->n_chunks; i++) {
+		struct pscnv_chunk *cnk = &bo->chunks[i];
+		
+		if (cnk->alloc_type != PSCNV_CHUNK_SYSRAM ||
+		    !(cnk->flags & PSCNV_CHUNK_SWAPPED)) {
+			continue;
+		}
+		
+		ret = pscnv_vram_from_host(cnk);
+		if (ret) {
+			NV_ERROR(dev, "pscnv_swapping_restore_bo: failed to "
+				"restore %08x/%d-%u\n", bo->cookie, bo->serial,
+				cnk->idx);
+			return ret;
+		}
+	}
+	
+	return 0;
+}
 
 static void
 increase_vram_work_func(struct work_struct *work)
@@ -1266,6 +2326,12 @@ increase_vram_work_func(struct work_struct *work)
 	struct drm_device *dev = swapping->dev;
 	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	
+	if (dev_priv->vram_limit) {
+		pscnv_swapping_check_headroom(dev);
+	}
+	
+	pscnv_clients_update_pinned(dev);
+	
 	if (pscnv_clients_vram_swapped(dev) > 0 &&
 		(pscnv_swapping_mem_avail(dev) > PSCNV_INCREASE_THRESHOLD) &&
 		(time_after(jiffies, dev_priv->last_mem_alloc_change_time + HZ/20))) {
@@ -1273,7 +2339,16 @@ increase_vram_work_func(struct work_struct *work)
 			pscnv_swapping_increase_vram(dev);
 	}
 	
-	schedule_delayed_work(dwork, PSCNV_INCREASE_RATE);
+	if (dev_priv->swapstore && pscnv_clients_vram_swapped(dev) > 0) {
+		pscnv_swapping_park_idle_clients(dev);
+		pscnv_swapstore_evict_cold(dev);
+	}
+	
+	if (pscnv_swap_ctx_delay) {
+		pscnv_chan_evict_idle(dev);
+	}
+	
+	pscnv_swapping_schedule_increase(swapping);
 }
 
 int
@@ -1297,14 +2372,16 @@ pscnv_swapping_required(struct pscnv_bo *bo)
 int
 pscnv_swapping_sysram_fallback(struct pscnv_chunk *cnk)
 {
-	struct pscnv_bo *bo = cnk->bo;
-	struct drm_device *dev = bo->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_client *cl = cnk->bo->client;
 	int ret;
 	
-	mutex_lock(&dev_priv->clients->lock);
+	if (!cl) {
+		return pscnv_swapping_sysram_fallback_unlocked(cnk, false);
+	}
+	
+	mutex_lock(&cl->lock);
 	ret = pscnv_swapping_sysram_fallback_unlocked(cnk, false);
-	mutex_unlock(&dev_priv->clients->lock);
+	mutex_unlock(&cl->lock);
 	
 	return ret;
 }
@@ -6,19 +6,47 @@
 
 #define PSCNV_INITIAL_CHUNK_LIST_SIZE 4UL
 
+/* maximum number of other clients that may share the BOs of one swaptask */
+#define PSCNV_SWAPTASK_MAX_SHARERS 16
+
 struct pscnv_swapping {
 	struct drm_device *dev;
 	atomic_t swaptask_serial;
 	struct delayed_work increase_vram_work;
 	
-	/* gets completed every time some swapping operation is completed */
-	struct completion next_swap;
+	/* samples channel activity of clients with swapped chunks, see
+	 * pscnv_chan_engine.read_ib_put */
+	struct delayed_work activity_work;
+	
+	/* cpu on the NUMA node of the card that runs increase_vram_work, or
+	 * -1 if any cpu will do */
+	int cpu;
+	
+	/* true, if there was more than PSCNV_INCREASE_THRESHOLD of free VRAM
+	 * at the last check */
+	bool headroom;
+	
+	/* serial of the current pscnv_swapping_increase_vram run, see
+	 * pscnv_client.swapin_skip_run. Protected by clients->lock */
+	unsigned int swapin_run;
 };
 
 struct pscnv_chunk_list {
 	struct pscnv_chunk **chunks;
 	size_t size;
 	size_t max;
+	
+	/* chunks are sorted by swap-in benefit, best last. Only used for
+	 * already_swapped, any change that may break the order clears it */
+	bool ordered;
+	/* jiffies of the last sort, benefits change as BOs age */
+	unsigned long order_time;
+};
+
+/* channels paused by pscnv_client_pause_channels, each with a reference */
+struct pscnv_paused_chans {
+	struct pscnv_chan **chans;
+	int n;
 };
 
 /* a swaptask collects all chunks that the source client selected for swapping
@@ -47,6 +75,13 @@ struct pscnv_swaptask {
 	/* completion that will be fired when all work in this swaptask has been
 	 * completed */
 	struct completion completion;
+	
+	/* clients that have been paused along with tgt, because they share
+	 * a BO of a selected chunk, and the channels of each of them that
+	 * have been paused. Holds references */
+	struct pscnv_client *sharers[PSCNV_SWAPTASK_MAX_SHARERS];
+	struct pscnv_paused_chans sharer_chans[PSCNV_SWAPTASK_MAX_SHARERS];
+	int n_sharers;
 };
 
 /* called once on driver load */
@@ -88,6 +123,11 @@ pscnv_swapping_add_bo(struct pscnv_bo *bo);
 int
 pscnv_swapping_remove_bo(struct pscnv_bo *bo);
 
+/* first half of the above that never blocks for long: take bo off the lists
+ * and cancel the swaps that did not start yet. Copies in flight continue */
+void
+pscnv_swapping_cancel_bo(struct pscnv_bo *bo);
+
 /*
  * ask the swapping system to swap out given amount of vram (in bytes)
  *
@@ -108,10 +148,42 @@ pscnv_swapping_required(struct pscnv_bo *bo);
 int
 pscnv_swapping_increase_vram(struct drm_device *dev);
 
+/*
+ * fill in the VRAM usage of client cl (may be NULL) along with its share of
+ * the VRAM and the amount of VRAM that nobody uses or demands */
+void
+pscnv_swapping_vram_budget(struct drm_device *dev, struct pscnv_client *cl,
+				struct drm_pscnv_vram_budget *budget);
+
 /*
  * allocate a chunk as SYSRAM and also put it into the already_swapped list
  * of the client that owns it, if it is swappable */
 int
 pscnv_swapping_sysram_fallback(struct pscnv_chunk *cnk);
 
+/*
+ * move all chunks of cl that are kept in the swapstore back to SYSRAM. Has to
+ * be called before cl may access its swapped memory through the GPU again */
+void
+pscnv_swapping_unpark_client(struct pscnv_client *cl);
+
+/* same as above, for the chunks of a single bo */
+void
+pscnv_swapping_unpark_bo(struct pscnv_bo *bo);
+
+/* get all swapped chunks of a user bo back into VRAM and keep the swapping
+ * system from touching it again, like pscnv_swapping_remove_bo. Fails without
+ * removing bo, if some of its chunks are still swapped */
+int
+pscnv_swapping_pin_bo(struct pscnv_bo *bo);
+
+/* move all VRAM chunks of a kernel bo to SYSRAM, while the GPU is not using
+ * it. All mappings stay valid */
+int
+pscnv_swapping_evict_bo(struct pscnv_bo *bo);
+
+/* move the chunks of a bo that has been evicted above back to VRAM */
+int
+pscnv_swapping_restore_bo(struct pscnv_bo *bo);
+
 #endif /* end of include guard: PSCNV_SWAPPING_H */
@@ -0,0 +1,803 @@
+#include "pscnv_swapstore.h"
+#include "pscnv_sysram.h"
+#include "pscnv_vm.h"
+#include "pscnv_client.h"
+
+#include <linux/lzo.h>
+#include <linux/highmem.h>
+#include <linux/vmalloc.h>
+#include <linux/jhash.h>
+#include <linux/shmem_fs.h>
+#include <linux/file.h>
+
+static int
+pscnv_swapstore_shrink(struct shrinker *shrinker, struct shrink_control *sc);
+
+static void
+pscnv_swapstore_evict_work_func(struct work_struct *work);
+
+/* called once on driver load */
+int
+pscnv_swapstore_init(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_swapstore *store;
+	int i;
+
+	if (!pscnv_swap_compress) {
+		return 0;
+	}
+
+	store = kzalloc(sizeof(struct pscnv_swapstore), GFP_KERNEL);
+	if (!store) {
+		NV_ERROR(dev, "Out of memory\n");
+		return -ENOMEM;
+	}
+
+	store->dev = dev;
+	mutex_init(&store->lock);
+	atomic_set(&store->entries, 0);
+	atomic_set(&store->shared, 0);
+	atomic64_set(&store->stored_bytes, 0);
+	atomic64_set(&store->data_bytes, 0);
+	atomic64_set(&store->file_bytes, 0);
+	init_waitqueue_head(&store->wq);
+	INIT_WORK(&store->evict_work, pscnv_swapstore_evict_work_func);
+	atomic_long_set(&store->evict_pages, 0);
+	for (i = 0; i < PSCNV_SWAPSTORE_HASH_SIZE; i++) {
+		INIT_HLIST_HEAD(&store->hash[i]);
+	}
+
+	dev_priv->swapstore = store;
+
+	/* there is nothing to reclaim without the swapstore, so this is only
+	 * done if swap_compress is set */
+	store->shrinker.shrink = pscnv_swapstore_shrink;
+	store->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&store->shrinker);
+
+	if (pscnv_swapping_debug >= 1) {
+		NV_INFO(dev, "pscnv_swapstore: compressing swapped chunks of "
+			     "idle clients\n");
+	}
+
+	return 0;
+}
+
+/* called once on driver shutdown */
+void
+pscnv_swapstore_exit(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_swapstore *store = dev_priv->swapstore;
+
+	if (!store) {
+		return;
+	}
+
+	unregister_shrinker(&store->shrinker);
+	cancel_work_sync(&store->evict_work);
+
+	WARN_ON(atomic_read(&store->entries) != 0);
+
+	vfree(store->staging);
+	kfree(store);
+	dev_priv->swapstore = NULL;
+}
+
+bool
+pscnv_swapstore_enabled(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+
+	return dev_priv->swapstore != NULL;
+}
+
+bool
+pscnv_swapstore_chunk_parkable(struct pscnv_chunk *cnk)
+{
+	struct pscnv_bo *bo = cnk->bo;
+
+	return cnk->alloc_type == PSCNV_CHUNK_SYSRAM &&
+	       (cnk->flags & PSCNV_CHUNK_SWAPPED) &&
+	       bo->primary_node && atomic_read(&bo->vm_maps) == 1 &&
+	       !bo->vma && !bo->vmap && !bo->map1 && !bo->map3;
+}
+
+/* returns true, if the page consists of a single repeated value only. This
+ * also catches all-zero pages */
+static bool
+pscnv_swapstore_page_same(const uint32_t *src, uint32_t *val)
+{
+	unsigned i;
+
+	for (i = 1; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+		if (src[i] != src[0]) {
+			return false;
+		}
+	}
+
+	*val = src[0];
+	return true;
+}
+
+/* take the spare staging buffer if it is large enough, or allocate a new one
+ * of size bytes. Either way, the buffer belongs to the caller afterwards */
+static void *
+pscnv_swapstore_get_staging(struct pscnv_swapstore *store, size_t size)
+{
+	void *buf = NULL;
+
+	mutex_lock(&store->lock);
+	if (store->staging && store->staging_size >= size) {
+		buf = store->staging;
+		store->staging = NULL;
+		store->staging_size = 0;
+	}
+	mutex_unlock(&store->lock);
+
+	if (!buf) {
+		buf = vmalloc(size);
+	}
+
+	return buf;
+}
+
+/* keep buf as the spare staging buffer, unless there is a larger one
+ * already. Called with store->lock held */
+static void
+pscnv_swapstore_put_staging_unlocked(struct pscnv_swapstore *store,
+				     void *buf, size_t size)
+{
+	if (store->staging_size >= size) {
+		vfree(buf);
+		return;
+	}
+
+	vfree(store->staging);
+	store->staging = buf;
+	store->staging_size = size;
+}
+
+static uint64_t
+pscnv_swapstore_entry_bytes(struct pscnv_swapstore_entry *entry)
+{
+	return sizeof(struct pscnv_swapstore_entry) +
+	       entry->n_pages * sizeof(struct pscnv_swapstore_page) +
+	       (entry->file ? 0 : entry->data_size);
+}
+
+static uint32_t
+pscnv_swapstore_hash(struct pscnv_swapstore_entry *entry, const void *data)
+{
+	uint32_t hash;
+
+	hash = jhash(entry->pages,
+		entry->n_pages * sizeof(struct pscnv_swapstore_page),
+		entry->n_pages);
+
+	return jhash(data, entry->data_size, hash);
+}
+
+/* find an entry with the same contents as entry, whose compressed data is
+ * passed in data. Called with store->lock held */
+static struct pscnv_swapstore_entry *
+pscnv_swapstore_lookup_unlocked(struct pscnv_swapstore *store,
+				struct pscnv_swapstore_entry *entry, const void *data)
+{
+	struct pscnv_swapstore_entry *cur;
+	struct hlist_head *head;
+	struct hlist_node *pos;
+
+	head = &store->hash[entry->hash & (PSCNV_SWAPSTORE_HASH_SIZE - 1)];
+
+	hlist_for_each_entry(cur, pos, head, hash_node) {
+		if (cur->hash != entry->hash ||
+		    cur->n_pages != entry->n_pages ||
+		    cur->data_size != entry->data_size) {
+			continue;
+		}
+		if (cur->file) {
+			/* not worth reading it back */
+			continue;
+		}
+		if (memcmp(cur->pages, entry->pages,
+			   entry->n_pages * sizeof(struct pscnv_swapstore_page))) {
+			continue;
+		}
+		if (entry->data_size && memcmp(cur->data, data, entry->data_size)) {
+			continue;
+		}
+		return cur;
+	}
+
+	return NULL;
+}
+
+/* compresses the chunk into a staging buffer of its own, so that store->lock
+ * is only needed to find a duplicate and to insert the new entry */
+static struct pscnv_swapstore_entry *
+pscnv_swapstore_compress(struct pscnv_swapstore *store, struct pscnv_chunk *cnk)
+{
+	struct drm_device *dev = store->dev;
+	struct pscnv_bo *bo = cnk->bo;
+	struct pscnv_swapstore_entry *entry, *dup;
+	struct pscnv_swapstore_page *page;
+	uint32_t n_pages = pscnv_chunk_size(cnk) >> PAGE_SHIFT;
+	size_t staging_size = n_pages * lzo1x_worst_compress(PAGE_SIZE);
+	struct pscnv_sysram_iter it;
+	struct page *src_page;
+	void *staging, *wrkmem;
+	uint32_t used = 0;
+	uint32_t i;
+	size_t out_len;
+	void *src;
+	int ret;
+
+	entry = kzalloc(sizeof(struct pscnv_swapstore_entry) +
+			n_pages * sizeof(struct pscnv_swapstore_page), GFP_KERNEL);
+	if (!entry) {
+		return NULL;
+	}
+	entry->n_pages = n_pages;
+
+	staging = pscnv_swapstore_get_staging(store, staging_size);
+	wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	if (!staging || !wrkmem) {
+		NV_ERROR(dev, "pscnv_swapstore_compress: failed to allocate "
+			      "staging buffer\n");
+		vfree(wrkmem);
+		vfree(staging);
+		kfree(entry);
+		return NULL;
+	}
+
+	pscnv_sysram_iter_init(&it, cnk);
+	for (i = 0; i < n_pages; i++) {
+		page = &entry->pages[i];
+		src_page = pscnv_sysram_iter_next(&it);
+		src = kmap(src_page);
+
+		if (pscnv_swapstore_page_same(src, &page->value)) {
+			page->type = PSCNV_SWAPSTORE_SAME;
+			kunmap(src_page);
+			continue;
+		}
+
+		out_len = staging_size - used;
+		ret = lzo1x_1_compress(src, PAGE_SIZE, staging + used,
+					&out_len, wrkmem);
+
+		if (ret != LZO_E_OK || out_len >= PAGE_SIZE) {
+			/* not worth it */
+			memcpy(staging + used, src, PAGE_SIZE);
+			page->type = PSCNV_SWAPSTORE_RAW;
+			out_len = PAGE_SIZE;
+		} else {
+			page->type = PSCNV_SWAPSTORE_LZO;
+		}
+
+		kunmap(src_page);
+
+		page->offset = used;
+		page->len = out_len;
+		used += out_len;
+	}
+
+	vfree(wrkmem);
+
+	entry->data_size = used;
+	entry->hash = pscnv_swapstore_hash(entry, staging);
+
+	mutex_lock(&store->lock);
+	dup = pscnv_swapstore_lookup_unlocked(store, entry, staging);
+	if (dup) {
+		/* same contents are already stored for another chunk */
+		dup->refcnt++;
+		atomic_inc(&store->shared);
+		pscnv_swapstore_put_staging_unlocked(store, staging, staging_size);
+		mutex_unlock(&store->lock);
+		kfree(entry);
+		return dup;
+	}
+	mutex_unlock(&store->lock);
+
+	if (used) {
+		entry->data = vmalloc(used);
+		if (!entry->data) {
+			NV_ERROR(dev, "pscnv_swapstore_compress: out of memory "
+				      "for %u bytes of chunk %08x/%d-%u\n",
+				      used, bo->cookie, bo->serial, cnk->idx);
+			vfree(staging);
+			kfree(entry);
+			return NULL;
+		}
+		memcpy(entry->data, staging, used);
+	}
+
+	/* an entry with the same contents that has been inserted meanwhile is
+	 * not looked for again, the two just do not get shared */
+	mutex_lock(&store->lock);
+	entry->refcnt = 1;
+	entry->time = jiffies;
+	hlist_add_head(&entry->hash_node,
+		&store->hash[entry->hash & (PSCNV_SWAPSTORE_HASH_SIZE - 1)]);
+	atomic64_add(pscnv_swapstore_entry_bytes(entry), &store->data_bytes);
+	pscnv_swapstore_put_staging_unlocked(store, staging, staging_size);
+	mutex_unlock(&store->lock);
+
+	return entry;
+}
+
+/* copy the data of entry into a new shmem file, so that Linux may swap it
+ * out, and release its memory. Called with store->lock held */
+static int
+pscnv_swapstore_write_file_unlocked(struct pscnv_swapstore *store,
+				    struct pscnv_swapstore_entry *entry)
+{
+	struct file *file;
+	struct page *page;
+	uint32_t off, len;
+	void *dst;
+
+	file = shmem_file_setup("pscnv-swap", entry->data_size, VM_NORESERVE);
+	if (IS_ERR(file)) {
+		return PTR_ERR(file);
+	}
+
+	for (off = 0; off < entry->data_size; off += PAGE_SIZE) {
+		page = shmem_read_mapping_page(file->f_mapping, off >> PAGE_SHIFT);
+		if (IS_ERR(page)) {
+			fput(file);
+			return PTR_ERR(page);
+		}
+
+		len = min_t(uint32_t, PAGE_SIZE, entry->data_size - off);
+		dst = kmap(page);
+		memcpy(dst, entry->data + off, len);
+		kunmap(page);
+
+		set_page_dirty(page);
+		mark_page_accessed(page);
+		page_cache_release(page);
+	}
+
+	atomic64_sub(entry->data_size, &store->data_bytes);
+	atomic64_add(entry->data_size, &store->file_bytes);
+
+	vfree(entry->data);
+	entry->data = NULL;
+	entry->file = file;
+
+	return 0;
+}
+
+/* read the data of entry back from its shmem file into buf. The caller must
+ * be one of the readers of entry */
+static int
+pscnv_swapstore_read_file(struct pscnv_swapstore_entry *entry, void *buf)
+{
+	struct page *page;
+	uint32_t off, len;
+	void *src;
+
+	for (off = 0; off < entry->data_size; off += PAGE_SIZE) {
+		page = shmem_read_mapping_page(entry->file->f_mapping, off >> PAGE_SHIFT);
+		if (IS_ERR(page)) {
+			return PTR_ERR(page);
+		}
+
+		len = min_t(uint32_t, PAGE_SIZE, entry->data_size - off);
+		src = kmap(page);
+		memcpy(buf + off, src, len);
+		kunmap(page);
+
+		page_cache_release(page);
+	}
+
+	return 0;
+}
+
+/* move the data of entries that are older than min_age jiffies to shmem
+ * until at least nr_pages pages have been freed. Returns the number of pages
+ * freed. Called with store->lock held */
+static long
+pscnv_swapstore_evict_unlocked(struct pscnv_swapstore *store,
+			       unsigned long min_age, long nr_pages)
+{
+	struct drm_device *dev = store->dev;
+	struct pscnv_swapstore_entry *cur;
+	struct hlist_node *pos;
+	long freed = 0;
+	int i;
+	int ret;
+
+	for (i = 0; i < PSCNV_SWAPSTORE_HASH_SIZE; i++) {
+		hlist_for_each_entry(cur, pos, &store->hash[i], hash_node) {
+			if (!cur->data || cur->readers ||
+			    time_before(jiffies, cur->time + min_age)) {
+				continue;
+			}
+
+			ret = pscnv_swapstore_write_file_unlocked(store, cur);
+			if (ret) {
+				NV_ERROR(dev, "pscnv_swapstore_evict: failed "
+					      "to write %u bytes to shmem, "
+					      "ret = %d\n", cur->data_size, ret);
+				return freed;
+			}
+
+			freed += PAGE_ALIGN(cur->data_size) >> PAGE_SHIFT;
+			if (freed >= nr_pages) {
+				return freed;
+			}
+		}
+	}
+
+	return freed;
+}
+
+void
+pscnv_swapstore_evict_cold(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_swapstore *store = dev_priv->swapstore;
+	long freed;
+
+	if (!store || pscnv_swap_shmem_delay <= 0) {
+		return;
+	}
+
+	mutex_lock(&store->lock);
+	freed = pscnv_swapstore_evict_unlocked(store,
+			pscnv_swap_shmem_delay * HZ,
+			PSCNV_SWAPSTORE_PARK_PER_RUN * (dev_priv->chunk_size >> PAGE_SHIFT));
+	mutex_unlock(&store->lock);
+
+	if (freed && pscnv_swapping_debug >= 2) {
+		NV_INFO(dev, "pscnv_swapstore: moved %ld pages to shmem\n", freed);
+	}
+}
+
+/* pages that the shrinker can give back right away. Compressed data only
+ * becomes reclaimable by Linux once evict_work has moved it to shmem, from
+ * then on it is shmem's to count */
+static long
+pscnv_swapstore_reclaimable(struct pscnv_swapstore *store)
+{
+	return store->staging_size >> PAGE_SHIFT;
+}
+
+static void
+pscnv_swapstore_evict_work_func(struct work_struct *work)
+{
+	struct pscnv_swapstore *store =
+		container_of(work, struct pscnv_swapstore, evict_work);
+	struct drm_device *dev = store->dev;
+	long nr_pages = atomic_long_xchg(&store->evict_pages, 0);
+	long freed;
+
+	if (nr_pages <= 0) {
+		return;
+	}
+
+	mutex_lock(&store->lock);
+	freed = pscnv_swapstore_evict_unlocked(store, 0, nr_pages);
+	mutex_unlock(&store->lock);
+
+	if (pscnv_swapping_debug >= 2) {
+		NV_INFO(dev, "pscnv_swapstore: moved %ld pages to shmem on "
+			     "memory pressure\n", freed);
+	}
+}
+
+/* called by Linux on memory pressure. Only the staging buffer is dropped and
+ * reported here. Moving compressed data to shmem needs new pages before the
+ * old ones can be freed, so that is left to evict_work in the background
+ * instead of doing it in reclaim */
+static int
+pscnv_swapstore_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct pscnv_swapstore *store =
+		container_of(shrinker, struct pscnv_swapstore, shrinker);
+	long nr_to_scan = sc->nr_to_scan;
+
+	if (nr_to_scan > 0 && atomic64_read(&store->data_bytes) > 0) {
+		atomic_long_add(nr_to_scan, &store->evict_pages);
+		schedule_work(&store->evict_work);
+	}
+
+	if (nr_to_scan == 0) {
+		return pscnv_swapstore_reclaimable(store);
+	}
+
+	/* the lock may be held by someone who is allocating memory right now */
+	if (!mutex_trylock(&store->lock)) {
+		return -1;
+	}
+
+	if (store->staging) {
+		vfree(store->staging);
+		store->staging = NULL;
+		store->staging_size = 0;
+	}
+
+	mutex_unlock(&store->lock);
+
+	/* what is left after the staging buffer has been freed */
+	return pscnv_swapstore_reclaimable(store);
+}
+
+/* The caller must be one of the readers of entry, so that its data does not
+ * get moved to shmem meanwhile. Data in shmem is read into a buffer of its
+ * own */
+static int
+pscnv_swapstore_decompress(struct pscnv_swapstore *store,
+			   struct pscnv_swapstore_entry *entry, struct pscnv_chunk *cnk)
+{
+	struct drm_device *dev = store->dev;
+	struct pscnv_bo *bo = cnk->bo;
+	struct pscnv_swapstore_page *page;
+	const void *data = entry->data;
+	void *buf = NULL;
+	struct pscnv_sysram_iter it;
+	struct page *dst_page;
+	uint32_t *dst;
+	size_t out_len;
+	uint32_t i, j;
+	int ret = 0;
+
+	if (entry->file) {
+		buf = vmalloc(entry->data_size);
+		if (!buf)
+			ret = -ENOMEM;
+		if (!ret)
+			ret = pscnv_swapstore_read_file(entry, buf);
+		if (ret) {
+			NV_ERROR(dev, "pscnv_swapstore_decompress: failed to "
+				      "read chunk %08x/%d-%u from shmem\n",
+				      bo->cookie, bo->serial, cnk->idx);
+			vfree(buf);
+			return ret;
+		}
+		data = buf;
+	}
+
+	pscnv_sysram_iter_init(&it, cnk);
+	for (i = 0; i < entry->n_pages && !ret; i++) {
+		page = &entry->pages[i];
+		dst_page = pscnv_sysram_iter_next(&it);
+		dst = kmap(dst_page);
+
+		switch (page->type) {
+		case PSCNV_SWAPSTORE_SAME:
+			for (j = 0; j < PAGE_SIZE / sizeof(uint32_t); j++) {
+				dst[j] = page->value;
+			}
+			break;
+		case PSCNV_SWAPSTORE_LZO:
+			out_len = PAGE_SIZE;
+			if (lzo1x_decompress_safe(data + page->offset,
+					page->len, (void *)dst, &out_len) != LZO_E_OK ||
+			    out_len != PAGE_SIZE) {
+				ret = -EIO;
+			}
+			break;
+		case PSCNV_SWAPSTORE_RAW:
+			memcpy(dst, data + page->offset, PAGE_SIZE);
+			break;
+		default:
+			ret = -EINVAL;
+		}
+
+		kunmap(dst_page);
+	}
+
+	if (ret) {
+		NV_ERROR(dev, "pscnv_swapstore_decompress: page %u of chunk "
+			      "%08x/%d-%u is corrupted\n",
+			      i - 1, bo->cookie, bo->serial, cnk->idx);
+	}
+
+	vfree(buf);
+
+	return ret;
+}
+
+/* drop the reference of a single chunk to entry */
+static void
+pscnv_swapstore_entry_put(struct pscnv_swapstore *store,
+			  struct pscnv_swapstore_entry *entry)
+{
+	atomic64_sub((uint64_t)entry->n_pages << PAGE_SHIFT, &store->stored_bytes);
+	atomic_dec(&store->entries);
+
+	mutex_lock(&store->lock);
+	if (--entry->refcnt > 0) {
+		atomic_dec(&store->shared);
+		mutex_unlock(&store->lock);
+		return;
+	}
+	hlist_del(&entry->hash_node);
+	mutex_unlock(&store->lock);
+
+	atomic64_sub(pscnv_swapstore_entry_bytes(entry), &store->data_bytes);
+
+	if (entry->file) {
+		atomic64_sub(entry->data_size, &store->file_bytes);
+		fput(entry->file);
+	}
+
+	vfree(entry->data);
+	kfree(entry);
+}
+
+/* run pscnv_sysram_{alloc,free}_chunk without touching vram_swapped, the
+ * chunk counts as swapped all the time */
+static int
+pscnv_swapstore_sysram_alloc_chunk(struct pscnv_chunk *cnk)
+{
+	uint16_t swapped = cnk->flags & PSCNV_CHUNK_SWAPPED;
+	int ret;
+
+	cnk->flags &= ~(PSCNV_CHUNK_SWAPPED);
+	ret = pscnv_sysram_alloc_chunk(cnk);
+	cnk->flags |= swapped;
+
+	return ret;
+}
+
+static void
+pscnv_swapstore_sysram_free_chunk(struct pscnv_chunk *cnk)
+{
+	uint16_t swapped = cnk->flags & PSCNV_CHUNK_SWAPPED;
+
+	cnk->flags &= ~(PSCNV_CHUNK_SWAPPED);
+	pscnv_sysram_free_chunk(cnk);
+	cnk->flags |= swapped;
+}
+
+int
+pscnv_swapstore_park_chunk(struct pscnv_chunk *cnk)
+{
+	struct pscnv_bo *bo = cnk->bo;
+	struct drm_device *dev = bo->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_swapstore *store = dev_priv->swapstore;
+	struct pscnv_mm_node *primary_node = bo->primary_node;
+	struct pscnv_swapstore_entry *entry;
+
+	if (!store) {
+		return -ENODEV;
+	}
+
+	if (pscnv_chunk_expect_alloc_type(cnk, PSCNV_CHUNK_SYSRAM,
+					"pscnv_swapstore_park_chunk")) {
+		return -EINVAL;
+	}
+	WARN_ON(!(cnk->flags & PSCNV_CHUNK_SWAPPED));
+
+	entry = pscnv_swapstore_compress(store, cnk);
+	if (!entry) {
+		return -ENOMEM;
+	}
+
+	if (primary_node && primary_node->vspace) {
+		dev_priv->vm->do_unmap(primary_node->vspace,
+			primary_node->start + cnk->idx * dev_priv->chunk_size,
+			pscnv_chunk_size(cnk));
+	}
+
+	pscnv_swapstore_sysram_free_chunk(cnk);
+
+	cnk->alloc_type = PSCNV_CHUNK_SWAPSTORE;
+	cnk->stored = entry;
+
+	atomic_inc(&store->entries);
+	atomic64_add(pscnv_chunk_size(cnk), &store->stored_bytes);
+
+	if (pscnv_swapping_debug >= 2) {
+		NV_INFO(dev, "pscnv_swapstore: parked chunk %08x/%d-%u, "
+			     "%llu bytes in %u bytes (refcnt %u)\n",
+			     bo->cookie, bo->serial, cnk->idx,
+			     pscnv_chunk_size(cnk), entry->data_size,
+			     entry->refcnt);
+	}
+
+	return 0;
+}
+
+int
+pscnv_swapstore_unpark_chunk(struct pscnv_chunk *cnk)
+{
+	struct pscnv_bo *bo = cnk->bo;
+	struct drm_device *dev = bo->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_swapstore *store = dev_priv->swapstore;
+	struct pscnv_mm_node *primary_node = bo->primary_node;
+	struct pscnv_swapstore_entry *entry = cnk->stored;
+	int ret;
+
+	if (pscnv_chunk_expect_alloc_type(cnk, PSCNV_CHUNK_SWAPSTORE,
+					"pscnv_swapstore_unpark_chunk")) {
+		return -EINVAL;
+	}
+
+	cnk->alloc_type = PSCNV_CHUNK_UNALLOCATED;
+	cnk->stored = NULL;
+
+	ret = pscnv_swapstore_sysram_alloc_chunk(cnk);
+	if (ret) {
+		goto fail_sysram_alloc;
+	}
+
+	/* only pin the entry under the lock, decompressing and reading from
+	 * shmem may take a while */
+	mutex_lock(&store->lock);
+	entry->readers++;
+	mutex_unlock(&store->lock);
+
+	ret = pscnv_swapstore_decompress(store, entry, cnk);
+
+	mutex_lock(&store->lock);
+	entry->readers--;
+	mutex_unlock(&store->lock);
+	if (ret) {
+		goto fail_decompress;
+	}
+
+	if (primary_node && primary_node->vspace) {
+		ret = dev_priv->vm->do_map_chunk(primary_node->vspace, cnk,
+			primary_node->start + cnk->idx * dev_priv->chunk_size);
+		if (ret) {
+			NV_ERROR(dev, "pscnv_swapstore_unpark_chunk: failed to "
+				      "map chunk %08x/%d-%u\n",
+				      bo->cookie, bo->serial, cnk->idx);
+			goto fail_decompress;
+		}
+	}
+
+	pscnv_swapstore_entry_put(store, entry);
+
+	if (pscnv_swapping_debug >= 2) {
+		NV_INFO(dev, "pscnv_swapstore: unparked chunk %08x/%d-%u\n",
+			     bo->cookie, bo->serial, cnk->idx);
+	}
+
+	return 0;
+
+fail_decompress:
+	pscnv_swapstore_sysram_free_chunk(cnk);
+
+fail_sysram_alloc:
+	cnk->alloc_type = PSCNV_CHUNK_SWAPSTORE;
+	cnk->stored = entry;
+
+	return ret;
+}
+
+void
+pscnv_swapstore_free_chunk(struct pscnv_chunk *cnk)
+{
+	struct pscnv_bo *bo = cnk->bo;
+	struct drm_device *dev = bo->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+
+	if (pscnv_chunk_expect_alloc_type(cnk, PSCNV_CHUNK_SWAPSTORE,
+					"pscnv_swapstore_free_chunk")) {
+		return;
+	}
+
+	pscnv_swapstore_entry_put(dev_priv->swapstore, cnk->stored);
+
+	cnk->stored = NULL;
+	cnk->alloc_type = PSCNV_CHUNK_UNALLOCATED;
+
+	if (cnk->flags & PSCNV_CHUNK_SWAPPED) {
+		if (bo->client) {
+			pscnv_client_swapped_add(bo->client, -(int64_t)pscnv_chunk_size(cnk));
+		}
+	}
+
+	cnk->flags &= ~(PSCNV_CHUNK_SWAPPED);
+}
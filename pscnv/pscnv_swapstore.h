@@ -0,0 +1,172 @@
+#ifndef PSCNV_SWAPSTORE_H
+#define PSCNV_SWAPSTORE_H
+
+#include "nouveau_drv.h"
+#include "pscnv_mem.h"
+
+#include <linux/shrinker.h>
+
+/* The swapstore keeps the contents of swapped chunks in compressed form.
+ *
+ * Swapped chunks are normally still mapped as SYSRAM into the vspace of their
+ * client, so the GPU may access them at any time. A chunk may only be moved
+ * into the swapstore ("parked"), if the GPU can not access it. This is the
+ * case if the chunk is not mapped anywhere except for its primary node and
+ * the client is idle: it has no channels, or all of them have been paused
+ * by pscnv_chan_evict_idle() (see swap_ctx_delay). Such channels only get
+ * continued after their client has been unparked.
+ *
+ * Chunks are compressed after they have been swapped out to SYSRAM, so
+ * swapping out still needs the uncompressed pages for a while.
+ *
+ * Parked chunks have alloc_type PSCNV_CHUNK_SWAPSTORE and no PTEs. They get
+ * unparked back into SYSRAM before they become accessible again. */
+
+/* pscnv_swapstore_page.type */
+#define PSCNV_SWAPSTORE_SAME 0 /* page consists of a repeated 32bit value */
+#define PSCNV_SWAPSTORE_LZO  1 /* page is LZO compressed */
+#define PSCNV_SWAPSTORE_RAW  2 /* page did not compress, plain copy */
+
+/* number of buckets in the hashtable of stored contents, power of 2 */
+#define PSCNV_SWAPSTORE_HASH_SIZE 256
+
+/* maximum number of chunks that get parked in one run */
+#define PSCNV_SWAPSTORE_PARK_PER_RUN 16
+
+struct pscnv_swapstore_page {
+	uint32_t type;
+
+	/* bytes in entry->data, 0 for SAME pages */
+	uint32_t len;
+
+	union {
+		/* LZO and RAW: position in entry->data */
+		uint32_t offset;
+		/* SAME: the repeated value */
+		uint32_t value;
+	};
+};
+
+/* contents of one or more parked chunks. Chunks with identical contents,
+ * e.g. the same data loaded by different clients, share a single entry. Each
+ * chunk gets its own copy when it is unparked */
+struct pscnv_swapstore_entry {
+	/* position in pscnv_swapstore.hash */
+	struct hlist_node hash_node;
+
+	/* jhash of pages and data */
+	uint32_t hash;
+
+	/* number of chunks that use this entry, protected by store->lock */
+	uint32_t refcnt;
+
+	/* number of unparks that are reading data or file right now,
+	 * protected by store->lock. Neither moves while this is non-zero */
+	uint32_t readers;
+
+	/* bytes of compressed data */
+	uint32_t data_size;
+
+	/* compressed data of all pages, vmalloc'ed, NULL if all pages are
+	 * SAME pages or the data has been moved to file */
+	void *data;
+
+	/* shmem file that holds the data of an entry that has not been used
+	 * for swap_shmem_delay seconds, or NULL */
+	struct file *file;
+
+	/* jiffies when the entry was created */
+	unsigned long time;
+
+	uint32_t n_pages;
+
+	struct pscnv_swapstore_page pages[0];
+};
+
+/* one instance per device */
+struct pscnv_swapstore {
+	struct drm_device *dev;
+
+	/* protects staging, hash, the entry refcounts and readers.
+	 * May be held while allocating memory, so the shrinker only uses
+	 * trylock */
+	struct mutex lock;
+
+	/* all entries, hashed by their contents */
+	struct hlist_head hash[PSCNV_SWAPSTORE_HASH_SIZE];
+
+	/* spare buffer for compressing a whole chunk at once. Each compress
+	 * takes it for itself, or allocates another one if it is in use, and
+	 * hands it back afterwards */
+	void *staging;
+	size_t staging_size;
+
+	/* number of parked chunks */
+	atomic_t entries;
+
+	/* number of parked chunks that share their entry with another chunk */
+	atomic_t shared;
+
+	/* uncompressed size of all parked chunks */
+	atomic64_t stored_bytes;
+
+	/* memory that is actually used for keeping parked chunks */
+	atomic64_t data_bytes;
+
+	/* compressed data that has been moved to shmem files */
+	atomic64_t file_bytes;
+
+	/* woken up every time a chunk has been (un-)parked */
+	wait_queue_head_t wq;
+
+	/* lets Linux reclaim the staging buffer and pushes compressed data to
+	 * shmem through evict_work. As all of it belongs to the swapstore, it
+	 * is only registered if swap_compress is set */
+	struct shrinker shrinker;
+
+	/* moves compressed data to shmem on behalf of the shrinker, which
+	 * must not allocate shmem pages itself */
+	struct work_struct evict_work;
+
+	/* pages that the shrinker asked evict_work to free */
+	atomic_long_t evict_pages;
+};
+
+/* called once on driver load */
+int
+pscnv_swapstore_init(struct drm_device *dev);
+
+/* called once on driver shutdown */
+void
+pscnv_swapstore_exit(struct drm_device *dev);
+
+/* returns true, if the compressed swapstore is in use */
+bool
+pscnv_swapstore_enabled(struct drm_device *dev);
+
+/* returns true, if cnk is swapped to SYSRAM and nothing but the GPU mapping
+ * in the primary node may access it. Called with the lock of
+ * its client held */
+bool
+pscnv_swapstore_chunk_parkable(struct pscnv_chunk *cnk);
+
+/* compress the SYSRAM chunk cnk into the swapstore, remove its PTEs and free
+ * its pages. The caller must ensure that cnk is in none of the chunk lists */
+int
+pscnv_swapstore_park_chunk(struct pscnv_chunk *cnk);
+
+/* move a parked chunk back to SYSRAM and restore its PTEs in the primary
+ * node. Same requirements as above */
+int
+pscnv_swapstore_unpark_chunk(struct pscnv_chunk *cnk);
+
+/* move the data of entries that have been parked for more than
+ * swap_shmem_delay seconds to shmem, where Linux can reclaim it */
+void
+pscnv_swapstore_evict_cold(struct drm_device *dev);
+
+/* drop the contents of a parked chunk, called from pscnv_chunk_free */
+void
+pscnv_swapstore_free_chunk(struct pscnv_chunk *cnk);
+
+#endif /* end of include guard: PSCNV_SWAPSTORE_H */
@@ -2,11 +2,14 @@
 #include "nouveau_drv.h"
 #include "pscnv_mem.h"
 #include "pscnv_client.h"
+#include "pscnv_sysram.h"
 
 #include <linux/list.h>
 #include <linux/kernel.h>
 #include <linux/mutex.h>
 #include <linux/gfp.h>
+#include <linux/spinlock.h>
+#include <linux/scatterlist.h>
 
 static int
 pscnv_sysram_vm_fault(struct pscnv_bo *bo, struct vm_area_struct *vma, struct vm_fault *vmf)
@@ -19,105 +22,542 @@ pscnv_sysram_vm_fault(struct pscnv_bo *bo, struct vm_area_struct *vma, struct vm
 	uint32_t cnk_idx = pscnv_chunk_at_offset(dev, offset);
 	uint64_t offset_in_chunk = offset - cnk_idx * dev_priv->chunk_size;
 
-	res = bo->chunks[cnk_idx].pages[offset_in_chunk >> PAGE_SHIFT].k;
+	res = pscnv_sysram_page(&bo->chunks[cnk_idx], offset_in_chunk);
 	get_page(res);
 	vmf->page = res;
 	return 0;
 }
 
-int
-pscnv_sysram_alloc_chunk(struct pscnv_chunk *cnk)
+/* get a page that the GPU can address directly. Pages are taken from all of
+ * host memory, preferably from the NUMA node of the card. The allocator falls
+ * back to other nodes by itself. Only if the page is beyond the DMA mask of
+ * the card, which would need bounce buffers, we fall back to the DMA32 zone */
+static struct page *
+pscnv_sysram_alloc_page(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	int node = dev_to_node(&dev->pdev->dev);
+	struct page *page;
+	
+	if (dev_priv->dma_mask <= DMA_BIT_MASK(32)) {
+		return alloc_pages_node(node, GFP_KERNEL | GFP_DMA32, 0);
+	}
+	
+	page = alloc_pages_node(node, GFP_KERNEL | __GFP_NOWARN, 0);
+	if (page && page_to_phys(page) + PAGE_SIZE - 1 <= dev_priv->dma_mask) {
+		return page;
+	}
+	
+	if (page) {
+		__free_page(page);
+	}
+	
+	return alloc_pages_node(node, GFP_KERNEL | GFP_DMA32, 0);
+}
+
+/* try to fill pages with blocks of 1 << PSCNV_SYSRAM_LP_SHIFT bytes, that may
+ * be mapped to the GPU with large pages. Gives up without retrying if there
+ * is not enough unfragmented memory */
+static int
+pscnv_sysram_alloc_blocks(struct drm_device *dev, struct page **pages, int numpages)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	const int order = PSCNV_SYSRAM_LP_SHIFT - PAGE_SHIFT;
+	const int block = 1 << order;
+	int node = dev_to_node(&dev->pdev->dev);
+	gfp_t gfp = GFP_KERNEL | __GFP_NORETRY | __GFP_NOWARN;
+	struct page *page;
+	int i, j;
+	
+	if (dev_priv->dma_mask <= DMA_BIT_MASK(32)) {
+		gfp |= GFP_DMA32;
+	}
+	
+	for (i = 0; i < numpages; i += block) {
+		page = alloc_pages_node(node, gfp, order);
+		if (!page) {
+			goto fail;
+		}
+		if (page_to_phys(page) + (block << PAGE_SHIFT) - 1 > dev_priv->dma_mask) {
+			__free_pages(page, order);
+			goto fail;
+		}
+		
+		/* every page gets its own refcount, like the order 0 pages */
+		split_page(page, order);
+		
+		for (j = 0; j < block; j++) {
+			pages[i + j] = page + j;
+		}
+	}
+	
+	return 0;
+
+fail:
+	for (j = 0; j < i; j++)
+		put_page(pages[j]);
+	
+	return -ENOMEM;
+}
+
+/* number of runs of physically contiguous pages */
+static int
+pscnv_sysram_count_runs(struct page **pages, int numpages)
+{
+	int i, runs = 1;
+	
+	for (i = 1; i < numpages; i++) {
+		if (page_to_pfn(pages[i]) != page_to_pfn(pages[i - 1]) + 1)
+			runs++;
+	}
+	
+	return runs;
+}
+
+/* returns true, if all DMA segments of sgt start and end on a large page
+ * boundary, so the GPU can map them with large pages */
+static bool
+pscnv_sysram_sgt_is_lp(struct sg_table *sgt)
+{
+	const uint64_t mask = (1 << PSCNV_SYSRAM_LP_SHIFT) - 1;
+	struct scatterlist *sg;
+	int i;
+	
+	for_each_sg(sgt->sgl, sg, sgt->nents, i) {
+		if ((sg_dma_address(sg) & mask) || (sg_dma_len(sg) & mask))
+			return false;
+	}
+	
+	return true;
+}
+
+/* allocate the pages of cnk, collect runs of contiguous pages into an
+ * sg_table and DMA-map it, without any accounting. The IOMMU, if there is
+ * one, may merge the segments even further. The array of pages is kept in
+ * cnk->pages */
+static int
+pscnv_sysram_get_pages(struct pscnv_chunk *cnk)
 {
 	struct pscnv_bo *bo = cnk->bo;
 	struct drm_device *dev = bo->dev;
-	struct drm_nouveau_private *dev_priv = dev->dev_private;
 	
 	uint64_t size = pscnv_chunk_size(cnk);
 	int numpages = size >> PAGE_SHIFT;
+	struct page **pages;
+	struct sg_table *sgt;
+	struct scatterlist *sg;
+	int i, j, run;
+	
+	pages = kmalloc(numpages * sizeof(struct page *), GFP_KERNEL);
+	if (!pages) {
+		return -ENOMEM;
+	}
+	
+	if ((size & ((1 << PSCNV_SYSRAM_LP_SHIFT) - 1)) != 0 ||
+	    pscnv_sysram_alloc_blocks(dev, pages, numpages)) {
+		for (i = 0; i < numpages; i++) {
+			pages[i] = pscnv_sysram_alloc_page(dev);
+			if (!pages[i]) {
+				NV_ERROR(dev, "pscnv_sysram_alloc_chunk: %08x/%d-%u "
+						"failed to get page no %d\n",
+						bo->cookie, bo->serial, cnk->idx, i);
+				goto fail_pages;
+			}
+		}
+	}
+	
+	sgt = kmalloc(sizeof(struct sg_table), GFP_KERNEL);
+	if (!sgt) {
+		goto fail_sgt;
+	}
+	
+	if (sg_alloc_table(sgt, pscnv_sysram_count_runs(pages, numpages), GFP_KERNEL)) {
+		goto fail_sg_alloc;
+	}
+	
+	sg = sgt->sgl;
+	for (i = 0; i < numpages; i = j) {
+		for (j = i + 1; j < numpages; j++) {
+			if (page_to_pfn(pages[j]) != page_to_pfn(pages[j - 1]) + 1)
+				break;
+		}
+		run = j - i;
+		sg_set_page(sg, pages[i], run << PAGE_SHIFT, 0);
+		sg = sg_next(sg);
+	}
+	
+	sgt->nents = pci_map_sg(dev->pdev, sgt->sgl, sgt->orig_nents, PCI_DMA_BIDIRECTIONAL);
+	if (!sgt->nents) {
+		NV_ERROR(dev, "pscnv_sysram_alloc_chunk: %08x/%d-%u "
+				"failed to dma-map %u segments\n",
+				bo->cookie, bo->serial, cnk->idx, sgt->orig_nents);
+		goto fail_map;
+	}
+	
+	if (pscnv_sysram_sgt_is_lp(sgt)) {
+		cnk->flags |= PSCNV_CHUNK_SYSRAM_LP;
+	}
+	
+	cnk->sgt = sgt;
+	cnk->pages = pages;
+	
+	return 0;
+
+fail_map:
+	sg_free_table(sgt);
+fail_sg_alloc:
+	kfree(sgt);
+fail_sgt:
+	i = numpages;
+fail_pages:
+	for (j = 0; j < i; j++)
+		put_page(pages[j]);
+	kfree(pages);
+	
+	return -ENOMEM;
+}
+
+/* unmap and free an sg_table and its array of pages, as filled by
+ * pscnv_sysram_get_pages */
+static void
+pscnv_sysram_put_pages(struct drm_device *dev, struct sg_table *sgt,
+		       struct page **pages)
+{
+	struct scatterlist *sg;
 	int i, j;
 	
-	if (pscnv_chunk_expect_alloc_type(cnk, PSCNV_CHUNK_UNALLOCATED,
-						"pscnv_sysram_alloc_chunk")) {
-		return -EINVAL;
+	pci_unmap_sg(dev->pdev, sgt->sgl, sgt->orig_nents, PCI_DMA_BIDIRECTIONAL);
+	
+	for_each_sg(sgt->sgl, sg, sgt->orig_nents, i) {
+		for (j = 0; j < sg->length >> PAGE_SHIFT; j++)
+			put_page(nth_page(sg_page(sg), j));
+	}
+	
+	sg_free_table(sgt);
+	kfree(sgt);
+	kfree(pages);
+}
+
+struct page *
+pscnv_sysram_page(struct pscnv_chunk *cnk, uint64_t offset)
+{
+	if (WARN_ON(offset >= pscnv_chunk_size(cnk)))
+		return NULL;
+	
+	return cnk->pages[offset >> PAGE_SHIFT];
+}
+
+void
+pscnv_sysram_get_page_array(struct pscnv_chunk *cnk, struct page **pages)
+{
+	int numpages = pscnv_chunk_size(cnk) >> PAGE_SHIFT;
+	
+	memcpy(pages, cnk->pages, numpages * sizeof(struct page *));
+}
+
+/* total length of all pages in sgt */
+static uint64_t
+pscnv_sysram_sgt_size(struct sg_table *sgt)
+{
+	struct scatterlist *sg;
+	uint64_t size = 0;
+	int i;
+	
+	for_each_sg(sgt->sgl, sg, sgt->orig_nents, i) {
+		size += sg->length;
 	}
 	
-	WARN_ON(cnk->pages);
+	return size;
+}
+
+/* number of backings in the pool */
+static int
+pscnv_sysram_pool_count(struct pscnv_sysram_pool *pool)
+{
+	int count;
 	
-	cnk->pages = kzalloc(numpages * sizeof(struct pscnv_page_and_dma), GFP_KERNEL);
+	spin_lock(&pool->lock);
+	count = pool->count;
+	spin_unlock(&pool->lock);
 	
-	for (i = 0; i < numpages; i++) {
-		cnk->pages[i].k = alloc_pages(dev_priv->dma_mask > 0xffffffff ? GFP_DMA32 : GFP_KERNEL, 0);
-		if (!cnk->pages[i].k) {
-			NV_ERROR(dev, "pscnv_sysram_alloc_chunk: %08x/%d-%u "
-					"failed to get page no %d\n",
-					bo->cookie, bo->serial, cnk->idx, i);
-			
-			for (j = 0; j < i; j++)
-				put_page(cnk->pages[j].k);
-			kfree(cnk->pages);
-			cnk->pages = NULL;
-			return -ENOMEM;
+	return count;
+}
+
+/* take a backing of the size of cnk from the pool, returns false if there is
+ * none. The most recently used backing that fits is taken */
+static bool
+pscnv_sysram_pool_get(struct pscnv_sysram_pool *pool, struct pscnv_chunk *cnk)
+{
+	struct pscnv_sysram_backing *cur, *backing = NULL;
+	uint64_t size = pscnv_chunk_size(cnk);
+	
+	spin_lock(&pool->lock);
+	list_for_each_entry(cur, &pool->backings, list) {
+		if (cur->size == size) {
+			backing = cur;
+			list_del(&backing->list);
+			pool->count--;
+			break;
 		}
 	}
+	spin_unlock(&pool->lock);
+	
+	if (!backing) {
+		atomic_inc(&pool->misses);
+		return false;
+	}
 	
-	for (i = 0; i < numpages; i++) {
-		cnk->pages[i].dma = pci_map_page(bo->dev->pdev, cnk->pages[i].k, 0, PAGE_SIZE, PCI_DMA_BIDIRECTIONAL);
-		if (pci_dma_mapping_error(bo->dev->pdev, cnk->pages[i].dma)) {
-			NV_ERROR(dev, "pscnv_sysram_alloc_chunk: %08x/%d-%u "
-					"failed to dma-map page no %d\n",
-					bo->cookie, bo->serial, cnk->idx, i);
-			for (j = 0; j < i; j++)
-				pci_unmap_page(bo->dev->pdev, cnk->pages[j].dma, PAGE_SIZE, PCI_DMA_BIDIRECTIONAL);
-			for (j = 0; j < numpages; j++)
-				put_page(cnk->pages[j].k);
-			kfree(cnk->pages);
-			cnk->pages = NULL;
-			return -ENOMEM;
+	atomic_inc(&pool->hits);
+	
+	cnk->sgt = backing->sgt;
+	cnk->pages = backing->pages;
+	if (backing->lp) {
+		cnk->flags |= PSCNV_CHUNK_SYSRAM_LP;
+	}
+	kfree(backing);
+	
+	return true;
+}
+
+/* keep the pages of cnk in the pool, returns false if the pool is full or
+ * cnk does not have the regular chunk size */
+static bool
+pscnv_sysram_pool_put(struct pscnv_sysram_pool *pool, struct pscnv_chunk *cnk)
+{
+	struct drm_nouveau_private *dev_priv = pool->dev->dev_private;
+	struct pscnv_sysram_backing *backing;
+	uint64_t size = pscnv_chunk_size(cnk);
+	
+	if (!dev_priv->chunk_size || size != dev_priv->chunk_size) {
+		return false;
+	}
+	
+	/* the pages must cover the chunk exactly, or the next user of the
+	 * backing would get a wrong layout */
+	if (pscnv_sysram_sgt_size(cnk->sgt) != size) {
+		return false;
+	}
+	
+	if (pscnv_sysram_pool_count(pool) >= pscnv_swap_pool_size) {
+		return false;
+	}
+	
+	backing = kmalloc(sizeof(struct pscnv_sysram_backing), GFP_KERNEL);
+	if (!backing) {
+		return false;
+	}
+	
+	backing->sgt = cnk->sgt;
+	backing->pages = cnk->pages;
+	backing->size = size;
+	backing->lp = !!(cnk->flags & PSCNV_CHUNK_SYSRAM_LP);
+	
+	spin_lock(&pool->lock);
+	if (pool->count >= pscnv_swap_pool_size) {
+		spin_unlock(&pool->lock);
+		kfree(backing);
+		return false;
+	}
+	list_add(&backing->list, &pool->backings);
+	pool->count++;
+	spin_unlock(&pool->lock);
+	
+	return true;
+}
+
+/* release up to nr backings from the pool, returns the number of pages that
+ * have been freed */
+static long
+pscnv_sysram_pool_release(struct pscnv_sysram_pool *pool, int nr)
+{
+	struct pscnv_sysram_backing *backing, *tmp;
+	LIST_HEAD(victims);
+	long freed = 0;
+	
+	spin_lock(&pool->lock);
+	while (nr-- > 0 && !list_empty(&pool->backings)) {
+		/* the oldest backings are at the tail */
+		backing = list_entry(pool->backings.prev,
+					struct pscnv_sysram_backing, list);
+		list_move(&backing->list, &victims);
+		pool->count--;
+	}
+	spin_unlock(&pool->lock);
+	
+	list_for_each_entry_safe(backing, tmp, &victims, list) {
+		pscnv_sysram_put_pages(pool->dev, backing->sgt, backing->pages);
+		freed += backing->size >> PAGE_SHIFT;
+		kfree(backing);
+	}
+	
+	return freed;
+}
+
+/* called by Linux on memory pressure, pooled backings are just a cache */
+static int
+pscnv_sysram_pool_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct pscnv_sysram_pool *pool =
+		container_of(shrinker, struct pscnv_sysram_pool, shrinker);
+	struct drm_nouveau_private *dev_priv = pool->dev->dev_private;
+	long chunk_pages = dev_priv->chunk_size >> PAGE_SHIFT;
+	
+	if (chunk_pages && sc->nr_to_scan > 0) {
+		pscnv_sysram_pool_release(pool,
+			(sc->nr_to_scan + chunk_pages - 1) / chunk_pages);
+	}
+	
+	return pscnv_sysram_pool_count(pool) * chunk_pages;
+}
+
+int
+pscnv_sysram_pool_init(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_sysram_pool *pool;
+	
+	if (pscnv_swap_pool_size <= 0) {
+		return 0;
+	}
+	
+	pool = kzalloc(sizeof(struct pscnv_sysram_pool), GFP_KERNEL);
+	if (!pool) {
+		NV_ERROR(dev, "pscnv_sysram_pool_init: out of memory\n");
+		return -ENOMEM;
+	}
+	
+	pool->dev = dev;
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->backings);
+	atomic_set(&pool->hits, 0);
+	atomic_set(&pool->misses, 0);
+	
+	pool->shrinker.shrink = pscnv_sysram_pool_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+	
+	dev_priv->sysram_pool = pool;
+	
+	return 0;
+}
+
+void
+pscnv_sysram_pool_exit(struct drm_device *dev)
+{
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_sysram_pool *pool = dev_priv->sysram_pool;
+	
+	if (!pool) {
+		return;
+	}
+	
+	unregister_shrinker(&pool->shrinker);
+	
+	dev_priv->sysram_pool = NULL;
+	
+	pscnv_sysram_pool_release(pool, INT_MAX);
+	
+	kfree(pool);
+}
+
+static int
+pscnv_sysram_alloc_chunk_pooled(struct pscnv_chunk *cnk, struct pscnv_sysram_pool *pool)
+{
+	struct pscnv_bo *bo = cnk->bo;
+	
+	uint64_t size = pscnv_chunk_size(cnk);
+	int numpages = size >> PAGE_SHIFT;
+	int ret;
+	
+	if (pscnv_chunk_expect_alloc_type(cnk, PSCNV_CHUNK_UNALLOCATED,
+						"pscnv_sysram_alloc_chunk")) {
+		return -EINVAL;
+	}
+	
+	WARN_ON(cnk->sgt);
+	
+	if (!pool || !pscnv_sysram_pool_get(pool, cnk)) {
+		ret = pscnv_sysram_get_pages(cnk);
+		if (ret) {
+			return ret;
 		}
 	}
 	
 	cnk->alloc_type = PSCNV_CHUNK_SYSRAM;
 	
+	if (bo->client) {
+		atomic64_add(numpages, &bo->client->sysram_pages);
+	}
+	
 	if (cnk->flags & PSCNV_CHUNK_SWAPPED) {
 		if (bo->client) {
-			atomic64_add(size, &bo->client->vram_swapped);
+			pscnv_client_swapped_add(bo->client, size);
 		}
 	}
 	
 	return 0;
 }
 
-void
-pscnv_sysram_free_chunk(struct pscnv_chunk *cnk)
+static void
+pscnv_sysram_free_chunk_pooled(struct pscnv_chunk *cnk, struct pscnv_sysram_pool *pool)
 {
 	struct pscnv_bo *bo = cnk->bo;
 	
 	uint64_t size = pscnv_chunk_size(cnk);
 	int numpages = size >> PAGE_SHIFT;
-	int i;
 	
 	if (pscnv_chunk_expect_alloc_type(cnk, PSCNV_CHUNK_SYSRAM,
 						"pscnv_sysram_free_chunk")) {
 		return;
 	}
 	
-	for (i = 0; i < numpages; i++)
-		pci_unmap_page(bo->dev->pdev, cnk->pages[i].dma, PAGE_SIZE, PCI_DMA_BIDIRECTIONAL);
-	for (i = 0; i < numpages; i++)
-		put_page(cnk->pages[i].k);
-	
-	kfree(cnk->pages);
+	if (!pool || !pscnv_sysram_pool_put(pool, cnk)) {
+		pscnv_sysram_put_pages(bo->dev, cnk->sgt, cnk->pages);
+	}
+	cnk->sgt = NULL;
 	cnk->pages = NULL;
 	
 	cnk->alloc_type = PSCNV_CHUNK_UNALLOCATED;
 	
+	if (bo->client) {
+		atomic64_sub(numpages, &bo->client->sysram_pages);
+	}
+	
 	if (cnk->flags & PSCNV_CHUNK_SWAPPED) {
 		if (bo->client) {
-			atomic64_sub(size, &bo->client->vram_swapped);
+			pscnv_client_swapped_add(bo->client, -(int64_t)size);
 		}
 	}
 	
-	cnk->flags &= ~(PSCNV_CHUNK_SWAPPED);
+	cnk->flags &= ~(PSCNV_CHUNK_SWAPPED | PSCNV_CHUNK_SYSRAM_LP);
+}
+
+int
+pscnv_sysram_alloc_chunk(struct pscnv_chunk *cnk)
+{
+	return pscnv_sysram_alloc_chunk_pooled(cnk, NULL);
+}
+
+void
+pscnv_sysram_free_chunk(struct pscnv_chunk *cnk)
+{
+	pscnv_sysram_free_chunk_pooled(cnk, NULL);
+}
+
+int
+pscnv_sysram_swap_alloc_chunk(struct pscnv_chunk *cnk)
+{
+	struct drm_nouveau_private *dev_priv = cnk->bo->dev->dev_private;
+	
+	return pscnv_sysram_alloc_chunk_pooled(cnk, dev_priv->sysram_pool);
+}
+
+void
+pscnv_sysram_swap_free_chunk(struct pscnv_chunk *cnk)
+{
+	struct drm_nouveau_private *dev_priv = cnk->bo->dev->dev_private;
+	
+	pscnv_sysram_free_chunk_pooled(cnk, dev_priv->sysram_pool);
 }
 
 int
@@ -169,16 +609,12 @@ pscnv_sysram_pages_total(struct pscnv_bo *bo)
 	
 	for (i = 0; i < bo->n_chunks; i++) {
 		struct pscnv_chunk *cnk = &bo->chunks[i];
-		const uint32_t pages_of_chunk = pscnv_chunk_size(cnk) >> PAGE_SHIFT;
-		uint32_t j = 0;
 		if (pscnv_chunk_expect_alloc_type(cnk, PSCNV_CHUNK_SYSRAM,
 							"pscnv_sysram_pages_total")) {
 			goto fail_expect;
 		}
 		
-		for (j = 0; j < pages_of_chunk; j++) {
-			pages_total[i*pages_per_chunk+j] = cnk->pages[j].k;
-		}
+		pscnv_sysram_get_page_array(cnk, &pages_total[i*pages_per_chunk]);
 	}
 	
 	return pages_total;
@@ -206,7 +642,7 @@ pscnv_sysram_vmap(struct pscnv_bo *bo)
 				PSCNV_CHUNK_SYSRAM, "pscnv_sysram_vmap")) {
 			return;
 		}
-		bo->vmap = kmap(bo->chunks[0].pages[0].k);
+		bo->vmap = kmap(sg_page(bo->chunks[0].sgt->sgl));
 		return;
 	}
 	
@@ -251,7 +687,7 @@ nv_rv32_sysram(struct pscnv_chunk *cnk, unsigned offset)
 	uint32_t *mem;
 	uint32_t val;
 
-	mem = kmap_atomic(cnk->pages[offset >> PAGE_SHIFT].k, KM_USER0);
+	mem = kmap_atomic(pscnv_sysram_page(cnk, offset), KM_USER0);
 	val = mem[(offset & 0xfff) >> 2];
 	kunmap_atomic(mem, KM_USER0);
 
@@ -263,7 +699,7 @@ nv_wv32_sysram(struct pscnv_chunk *cnk, unsigned offset, uint32_t val)
 {
 	uint32_t *mem;
 	
-	mem = kmap_atomic(cnk->pages[offset >> PAGE_SHIFT].k, KM_USER0);
+	mem = kmap_atomic(pscnv_sysram_page(cnk, offset), KM_USER0);
 	mem[(offset & 0xfff) >> 2] = val;
 	kunmap_atomic(mem, KM_USER0);
 }
@@ -3,6 +3,46 @@
 
 #include "pscnv_mem.h"
 
+#include <linux/shrinker.h>
+
+/* pages and DMA mappings of a SYSRAM chunk, kept in the pool */
+struct pscnv_sysram_backing {
+	struct list_head list;
+	struct sg_table *sgt;
+	struct page **pages;
+	uint64_t size;
+	bool lp;
+};
+
+/* Swapping a chunk out needs chunk_size bytes of DMA-mapped SYSRAM, swapping
+ * it back in frees them again. The pool keeps up to swap_pool_size of these
+ * backings, so they do not have to be allocated and mapped page by page every
+ * time. Backings of swapped in chunks are added to the front, the shrinker
+ * releases the oldest ones from the back. One instance per device, only if
+ * swap_pool_size > 0 */
+struct pscnv_sysram_pool {
+	struct drm_device *dev;
+
+	/* protects backings and count */
+	spinlock_t lock;
+	struct list_head backings;
+	int count;
+
+	/* number of swap-outs that did (not) get their pages from the pool */
+	atomic_t hits;
+	atomic_t misses;
+
+	struct shrinker shrinker;
+};
+
+/* called once on driver load */
+int
+pscnv_sysram_pool_init(struct drm_device *dev);
+
+/* called once on driver shutdown, after swapping has been stopped */
+void
+pscnv_sysram_pool_exit(struct drm_device *dev);
+
 int
 pscnv_sysram_alloc_chunk(struct pscnv_chunk *cnk);
 
@@ -12,6 +52,52 @@ pscnv_sysram_alloc(struct pscnv_bo *bo);
 void
 pscnv_sysram_free_chunk(struct pscnv_chunk *cnk);
 
+/* same as pscnv_sysram_alloc_chunk, but takes the pages from the pool if
+ * possible. Only for chunks that get overwritten by a swap-out, as the pages
+ * still contain the data of their previous user */
+int
+pscnv_sysram_swap_alloc_chunk(struct pscnv_chunk *cnk);
+
+/* same as pscnv_sysram_free_chunk, but gives the pages to the pool if it is
+ * not full */
+void
+pscnv_sysram_swap_free_chunk(struct pscnv_chunk *cnk);
+
+/* walks over all pages of a SYSRAM chunk, in order */
+struct pscnv_sysram_iter {
+	struct scatterlist *sg;
+	unsigned int idx;
+};
+
+static inline void
+pscnv_sysram_iter_init(struct pscnv_sysram_iter *it, struct pscnv_chunk *cnk)
+{
+	it->sg = cnk->sgt->sgl;
+	it->idx = 0;
+}
+
+/* returns the next page, must not be called more than once per page */
+static inline struct page *
+pscnv_sysram_iter_next(struct pscnv_sysram_iter *it)
+{
+	struct page *page = nth_page(sg_page(it->sg), it->idx);
+	
+	if (++it->idx == it->sg->length >> PAGE_SHIFT) {
+		it->sg = sg_next(it->sg);
+		it->idx = 0;
+	}
+	
+	return page;
+}
+
+/* page at offset within the SYSRAM chunk cnk */
+struct page *
+pscnv_sysram_page(struct pscnv_chunk *cnk, uint64_t offset);
+
+/* fill pages with all pages of the SYSRAM chunk cnk, in order */
+void
+pscnv_sysram_get_page_array(struct pscnv_chunk *cnk, struct page **pages);
+
 uint32_t
 nv_rv32_sysram(struct pscnv_chunk *chunk, unsigned offset);
 
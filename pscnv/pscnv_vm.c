@@ -30,6 +30,8 @@
 #include "pscnv_vm.h"
 #include "pscnv_chan.h"
 #include "pscnv_dma.h"
+#include "pscnv_swapping.h"
+#include "pscnv_client.h"
 
 
 static int pscnv_vspace_bind (struct pscnv_vspace *vs, int fake) {
@@ -114,6 +116,15 @@ static void
 pscnv_vspace_free_unmap(struct pscnv_mm_node *node) {
 	struct pscnv_bo *bo = node->bo;
 	struct drm_device *dev = bo->dev;
+	if (node->vspace->vid != 126) {
+		mutex_lock(&bo->maps_lock);
+		list_del_init(&node->bo_maps);
+		mutex_unlock(&bo->maps_lock);
+		atomic_dec(&bo->vm_maps);
+		if (bo->primary_node == node) {
+			bo->primary_node = NULL;
+		}
+	}
 	pscnv_mm_free(node);
 	if (pscnv_mem_debug >= 2) {
 		NV_INFO(dev, "vspace_free_unmap: unref BO%08x/%d\n", bo->cookie, bo->serial);
@@ -131,6 +142,8 @@ void pscnv_vspace_ref_free(struct kref *ref) {
 		pscnv_mm_takedown(vs->mm, pscnv_vspace_free_unmap);
 	dev_priv->vm->do_vspace_free(vs);
 	pscnv_vspace_unbind(vs);
+	if (vs->client)
+		pscnv_client_unref(vs->client);
 	kfree(vs);
 }
 
@@ -147,10 +160,24 @@ pscnv_vspace_unmap_node_unlocked(struct pscnv_mm_node *node) {
 		WARN_ON(1);
 	}
 	
+	/* no swapping may restore the PTEs once they are gone */
+	if (vs->vid >= 0 && vs->vid != 126) {
+		mutex_lock(&bo->maps_lock);
+		list_del_init(&node->bo_maps);
+		mutex_unlock(&bo->maps_lock);
+	}
+	
 	dev_priv->vm->do_unmap(vs, node->start, node->size);
 
 	pscnv_mm_free(node);
 	
+	if (vs->vid >= 0 && vs->vid != 126) {
+		atomic_dec(&bo->vm_maps);
+		if (bo->primary_node == node) {
+			bo->primary_node = NULL;
+		}
+	}
+	
 	if (vs->vid >= 0) {
 		if (pscnv_mem_debug >= 2) {
 			NV_INFO(dev, "vspace_unmap_node_unlocked: unref BO%08x/%d\n", bo->cookie, bo->serial);
@@ -178,12 +205,23 @@ pscnv_vspace_map(struct pscnv_vspace *vs, struct pscnv_bo *bo,
 		pscnv_bo_ref(bo);
 	}
 	
+	if (vs->vid != 126) {
+		/* chunks in the swapstore have no PTEs, get them back first.
+		 * vm_maps keeps them from being parked again */
+		if (vs->vid >= 0)
+			atomic_inc(&bo->vm_maps);
+		pscnv_swapping_unpark_bo(bo);
+	}
+	
 	mutex_lock(&vs->lock);
 	ret = dev_priv->vm->place_map(vs, bo, start, end, back, &node);
 	if (ret) {
 		mutex_unlock(&vs->lock);
 		NV_INFO(vs->dev, "VM: vspace %d: Mapping BO %x/%d:"
 			" place_map failed\n", vs->vid, bo->cookie, bo->serial);
+		if (vs->vid >= 0 && vs->vid != 126) {
+			atomic_dec(&bo->vm_maps);
+		}
 		if (vs->vid >= 0) {
 			if (pscnv_mem_debug >= 2) {
 				NV_INFO(dev, "vspace_map: unref BO%08x/%d\n", bo->cookie, bo->serial);
@@ -194,17 +232,27 @@ pscnv_vspace_map(struct pscnv_vspace *vs, struct pscnv_bo *bo,
 	}
 	node->bo = bo;
 	node->vspace = vs;
+	INIT_LIST_HEAD(&node->bo_maps);
 	if (pscnv_vm_debug >= 1)
 		NV_INFO(vs->dev, "VM: vspace %d: Mapping BO %x/%d at %llx-%llx.\n", vs->vid, bo->cookie, bo->serial, node->start,
 				node->start + node->size);
+	
+	/* chunks must not move between writing the PTEs and entering the
+	 * node into the reverse map */
+	mutex_lock(&bo->maps_lock);
 	ret = dev_priv->vm->do_map(vs, bo, node->start);
+	if (!ret && vs->vid >= 0 && vs->vid != 126) {
+		list_add_tail(&node->bo_maps, &bo->maps);
+	}
+	mutex_unlock(&bo->maps_lock);
+	
 	if (ret) {
 		NV_ERROR(vs->dev, "VM: vspace %d: Mapping BO %x/%d at %llx-%llx. FAILED \n", vs->vid, bo->cookie, bo->serial, node->start,
 				node->start + node->size);
 		pscnv_vspace_unmap_node_unlocked(node); // includes unref(bo)
 	}
 	
-	if (vs->vid >= 0 && vs->vid != 126 && !bo->primary_node) {
+	if (!ret && vs->vid >= 0 && vs->vid != 126 && !bo->primary_node) {
 		bo->primary_node = node;
 	}
 	
@@ -249,6 +297,7 @@ pscnv_vspace_map_chunk(struct pscnv_vspace *vs, struct pscnv_chunk *cnk,
 	}
 	node->bo = bo;
 	node->vspace = vs;
+	INIT_LIST_HEAD(&node->bo_maps);
 	if (pscnv_vm_debug >= 1) {
 		NV_INFO(vs->dev, "VM: vspace %d: Mapping Chunk %08x/%d-%u at "
 				 "%llx-%llx.\n", vs->vid, bo->cookie, bo->serial,
@@ -288,6 +337,76 @@ pscnv_vspace_unmap(struct pscnv_vspace *vs, uint64_t start) {
 	return ret;
 }
 
+static int
+pscnv_vspace_remap_node(struct pscnv_mm_node *node, struct pscnv_chunk *cnk)
+{
+	struct pscnv_bo *bo = cnk->bo;
+	struct drm_device *dev = bo->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	uint64_t offset = node->start + cnk->idx * dev_priv->chunk_size;
+	int ret;
+	
+	ret = dev_priv->vm->do_remap_chunk(node->vspace, cnk, offset);
+	if (ret) {
+		NV_ERROR(dev, "VM: vspace %d: Remapping Chunk %08x/%d-%u at "
+			"%llx failed\n", node->vspace->vid, bo->cookie,
+			bo->serial, cnk->idx, offset);
+	}
+	
+	return ret;
+}
+
+int
+pscnv_vspace_remap_chunk(struct pscnv_chunk *cnk)
+{
+	struct pscnv_bo *bo = cnk->bo;
+	struct drm_device *dev = bo->dev;
+	struct drm_nouveau_private *dev_priv = dev->dev_private;
+	struct pscnv_mm_node *node, *other;
+	int ret = 0;
+	
+	mutex_lock(&bo->maps_lock);
+	
+	list_for_each_entry(node, &bo->maps, bo_maps) {
+		ret = pscnv_vspace_remap_node(node, cnk);
+		if (ret)
+			break;
+	}
+	
+	/* kernel BOs may also be mapped into the BARs */
+	if (!ret && bo->map1) {
+		ret = pscnv_vspace_remap_node(bo->map1, cnk);
+	}
+	if (!ret && bo->map3) {
+		ret = pscnv_vspace_remap_node(bo->map3, cnk);
+	}
+	
+	dev_priv->vm->bar_flush(dev);
+	
+	if (bo->map1) {
+		dev_priv->vm->tlb_flush(bo->map1->vspace);
+	}
+	if (bo->map3) {
+		dev_priv->vm->tlb_flush(bo->map3->vspace);
+	}
+	
+	/* flush every vspace once, even if it maps the BO several times. On
+	 * error, the caller remaps the old chunk, which flushes the rest */
+	list_for_each_entry(node, &bo->maps, bo_maps) {
+		list_for_each_entry(other, &bo->maps, bo_maps) {
+			if (other == node || other->vspace == node->vspace)
+				break;
+		}
+		if (other == node) {
+			dev_priv->vm->tlb_flush(node->vspace);
+		}
+	}
+	
+	mutex_unlock(&bo->maps_lock);
+	
+	return ret;
+}
+
 struct pscnv_bo *
 pscnv_vspace_vm_addr_lookup(struct pscnv_vspace *vs, uint64_t addr)
 {
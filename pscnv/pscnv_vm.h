@@ -40,6 +40,9 @@ struct pscnv_vspace {
 	uint64_t size;
 	uint32_t flags;
 	void *engdata;
+	/* owner of a vspace that has been created through gdev, which holds a
+	 * reference on it. NULL for vspaces of the DRM interface */
+	struct pscnv_client *client;
 };
 
 struct pscnv_vm_engine {
@@ -51,6 +54,9 @@ struct pscnv_vm_engine {
 	int (*do_map) (struct pscnv_vspace *vs, struct pscnv_bo *bo, uint64_t offset);
 	int (*do_map_chunk) (struct pscnv_vspace *vs, struct pscnv_chunk *cnk, uint64_t offset);
 	int (*do_unmap) (struct pscnv_vspace *vs, uint64_t offset, uint64_t length);
+	/* like do_map_chunk on an already mapped chunk, but without flushes */
+	int (*do_remap_chunk) (struct pscnv_vspace *vs, struct pscnv_chunk *cnk, uint64_t offset);
+	int (*tlb_flush) (struct pscnv_vspace *vs);
 	int (*map_user) (struct pscnv_bo *);
 	int (*map_kernel) (struct pscnv_bo *);
 	void (*bar_flush) (struct drm_device *dev);
@@ -78,6 +84,12 @@ static inline void pscnv_vspace_unref(struct pscnv_vspace *vs) {
 	kref_put(&vs->ref, pscnv_vspace_ref_free);
 }
 
+/* point the PTEs of chunk cnk->idx in every user vspace and BAR that maps
+ * cnk->bo to the backing of cnk, which may be a temporary copy of the chunk.
+ * Every vspace gets flushed once, after all PTEs have been written */
+int
+pscnv_vspace_remap_chunk(struct pscnv_chunk *cnk);
+
 /* get the bo at addr in this vs or NULL */
 struct pscnv_bo *
 pscnv_vspace_vm_addr_lookup(struct pscnv_vspace *vs, uint64_t addr);
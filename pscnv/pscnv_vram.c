@@ -47,7 +47,7 @@ pscnv_vram_alloc_chunk(struct pscnv_chunk *cnk, int flags)
 	if (bo->flags & PSCNV_GEM_USER) {
 		WARN_ON(!bo->client);
 		if (bo->client) {
-			atomic64_add(size, &bo->client->vram_usage);
+			pscnv_bo_charge(bo, PSCNV_CHARGE_USAGE, size);
 			bo->client->vram_max = max(bo->client->vram_max,
 				(uint64_t) atomic64_read(&bo->client->vram_usage));
 		}
@@ -96,7 +96,7 @@ pscnv_vram_free_chunk(struct pscnv_chunk *cnk)
 	if (bo->flags & PSCNV_GEM_USER) {
 		WARN_ON(!bo->client);
 		if (bo->client) {
-			atomic64_sub(size, &bo->client->vram_usage);
+			pscnv_bo_charge(bo, PSCNV_CHARGE_USAGE, -(int64_t)size);
 		}
 	} else {
 		atomic64_sub(size, &dev_priv->vram_usage_kernel);
@@ -113,6 +113,7 @@ pscnv_vram_alloc(struct pscnv_bo *bo)
 	int ret = 0;
 	int swap_retries = 0;
 	int i = 0;
+	bool retry;
 	
 	/*if (bo->tile_flags & 0xffffff00)
 		return -EINVAL;*/
@@ -135,9 +136,7 @@ pscnv_vram_alloc(struct pscnv_bo *bo)
 	dev_priv->last_mem_alloc_change_time = jiffies;
 	
 	mutex_lock(&dev_priv->vram_mutex);
-	if (bo->client) {
-		atomic64_add(bo->size, &bo->client->vram_demand);
-	}
+	pscnv_bo_charge(bo, PSCNV_CHARGE_DEMAND, bo->size);
 	
 	while (pscnv_swapping_required(bo)) {
 		mutex_unlock(&dev_priv->vram_mutex);
@@ -176,6 +175,22 @@ pscnv_vram_alloc(struct pscnv_bo *bo)
 		}
 		
 		ret = pscnv_vram_alloc_chunk(cnk, flags);
+		if (ret) {
+			/* freed BOs count as free VRAM before their memory
+			 * is actually released. Only user BOs may wait for
+			 * that: kernel BOs like page tables get allocated with
+			 * a vspace lock held, which the free worker needs to
+			 * unmap the BOs it frees. Everybody else just kicks
+			 * the worker and tries once more */
+			mutex_unlock(&dev_priv->vram_mutex);
+			if (bo->flags & PSCNV_GEM_USER)
+				retry = pscnv_mem_flush_free(dev);
+			else
+				retry = pscnv_mem_kick_free(dev);
+			mutex_lock(&dev_priv->vram_mutex);
+			if (retry)
+				ret = pscnv_vram_alloc_chunk(cnk, flags);
+		}
 		if (ret) {
 			NV_WARN(dev, "pscnv_vram_alloc: failed to allocate chunk"
 				"%08x/%d-%u as VRAM. Fallback to SYSRAM.",
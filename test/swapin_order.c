@@ -0,0 +1,152 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <xf86drm.h>
+#include <stdio.h>
+#include "libpscnv.h"
+
+/* Checks that swap-in follows the gem_advise hints: half of the test BOs are
+ * marked WILLNEED, the other half DONTNEED. After VRAM has been filled up so
+ * that some of them get swapped, a part of the filler is freed again. As long
+ * as swapped WILLNEED chunks are left, no DONTNEED chunk may have come back. */
+
+#define TEST_BO_SIZE (16 << 20)
+#define TEST_BOS 8
+#define FILLER_PIECES 4
+
+int
+swapped_bytes(int fd, uint32_t *handles, int first, uint64_t *res)
+{
+	int ret;
+	int i;
+	uint64_t swapped;
+
+	*res = 0;
+	for (i = first; i < TEST_BOS; i += 2) {
+		ret = pscnv_gem_residency(fd, handles[i], NULL, NULL, NULL,
+					  NULL, NULL, &swapped);
+		if (ret) {
+			printf("gem_residency failed ret = %d\n", ret);
+			return ret;
+		}
+		*res += swapped;
+	}
+
+	return 0;
+}
+
+int
+main()
+{
+	int fd;
+	int ret;
+	int i;
+	uint32_t bos[TEST_BOS];
+	uint32_t filler, pieces[FILLER_PIECES];
+	uint64_t usage, swapped, demand, share, free;
+	uint64_t will0, dont0, will1, dont1;
+	int n_bos = 0, n_pieces = 0;
+	int have_filler = 0;
+
+	fd = drmOpen("pscnv", 0);
+
+	if (fd == -1) {
+		printf("failed to open DRM device\n");
+		return 1;
+	}
+
+	for (n_bos = 0; n_bos < TEST_BOS; n_bos++) {
+		ret = pscnv_gem_new(fd, 0x5a1f0000 | n_bos, PSCNV_GEM_VRAM_SMALL,
+				    0, TEST_BO_SIZE, NULL, &bos[n_bos], NULL);
+		if (ret) {
+			printf("gem_new failed ret = %d\n", ret);
+			goto out;
+		}
+		/* even: WILLNEED, odd: DONTNEED */
+		ret = pscnv_gem_advise(fd, bos[n_bos], (n_bos % 2) ?
+			PSCNV_ADVICE_DONTNEED : PSCNV_ADVICE_WILLNEED);
+		if (ret) {
+			printf("gem_advise failed ret = %d\n", ret);
+			n_bos++;
+			goto out;
+		}
+	}
+
+	/* fill all free VRAM, then push some chunks out */
+	ret = pscnv_vram_budget(fd, &usage, &swapped, &demand, &share, &free);
+	if (ret) {
+		printf("vram_budget failed ret = %d\n", ret);
+		goto out;
+	}
+
+	ret = pscnv_gem_new(fd, 0x5a1f1000, PSCNV_GEM_VRAM_SMALL, 0, free,
+			    NULL, &filler, NULL);
+	if (ret) {
+		printf("gem_new of %llu kB filler failed ret = %d\n",
+		       (unsigned long long) free >> 10, ret);
+		goto out;
+	}
+	have_filler = 1;
+
+	for (n_pieces = 0; n_pieces < FILLER_PIECES; n_pieces++) {
+		ret = pscnv_gem_new(fd, 0x5a1f2000 | n_pieces,
+				    PSCNV_GEM_VRAM_SMALL, 0, TEST_BO_SIZE,
+				    NULL, &pieces[n_pieces], NULL);
+		if (ret) {
+			printf("gem_new of filler piece failed ret = %d\n", ret);
+			goto out;
+		}
+	}
+
+	ret = swapped_bytes(fd, bos, 0, &will0);
+	if (!ret)
+		ret = swapped_bytes(fd, bos, 1, &dont0);
+	if (ret)
+		goto out;
+
+	printf("swapped: WILLNEED %llu kB, DONTNEED %llu kB\n",
+	       (unsigned long long) will0 >> 10,
+	       (unsigned long long) dont0 >> 10);
+
+	if (will0 == 0 || dont0 == 0) {
+		printf("not enough test BOs got swapped, skipping\n");
+		goto out;
+	}
+
+	/* make room for some of the swapped chunks, but not for all */
+	for (i = 0; i < FILLER_PIECES / 2; i++) {
+		pscnv_gem_close(fd, pieces[--n_pieces]);
+	}
+
+	/* swap-in runs from a delayed work */
+	sleep(2);
+
+	ret = swapped_bytes(fd, bos, 0, &will1);
+	if (!ret)
+		ret = swapped_bytes(fd, bos, 1, &dont1);
+	if (ret)
+		goto out;
+
+	printf("still swapped: WILLNEED %llu kB, DONTNEED %llu kB\n",
+	       (unsigned long long) will1 >> 10,
+	       (unsigned long long) dont1 >> 10);
+
+	if (will1 > 0 && dont1 < dont0) {
+		printf("FAIL: DONTNEED chunks came back before WILLNEED chunks\n");
+		ret = 1;
+	} else {
+		printf("OK\n");
+	}
+
+out:
+	while (n_pieces > 0)
+		pscnv_gem_close(fd, pieces[--n_pieces]);
+	if (have_filler)
+		pscnv_gem_close(fd, filler);
+	while (n_bos > 0)
+		pscnv_gem_close(fd, bos[--n_bos]);
+
+	close (fd);
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <xf86drm.h>
+#include <stdio.h>
+#include "libpscnv.h"
+
+#define TEST_GEM_SIZE (64 << 20)
+
+int
+print_budget(int fd, const char *when)
+{
+	int ret;
+	uint64_t usage, swapped, demand, share, free;
+	
+	ret = pscnv_vram_budget(fd, &usage, &swapped, &demand, &share, &free);
+	if (ret) {
+		printf("%s: vram_budget failed ret = %d\n", when, ret);
+		return ret;
+	}
+	
+	printf("%s: usage %llu kB, swapped %llu kB, demand %llu kB, "
+	       "share %llu kB, free %llu kB\n", when,
+	       (unsigned long long) usage >> 10,
+	       (unsigned long long) swapped >> 10,
+	       (unsigned long long) demand >> 10,
+	       (unsigned long long) share >> 10,
+	       (unsigned long long) free >> 10);
+	
+	return 0;
+}
+
+int
+print_residency(int fd, uint32_t gem_handle)
+{
+	int ret;
+	uint8_t residency[256];
+	uint32_t n_chunks = 1024;
+	uint32_t i;
+	uint64_t vram, sysram, swapped;
+	const char state[] = "-VSs";
+	
+	ret = pscnv_gem_residency(fd, gem_handle, &n_chunks, residency, NULL,
+				  &vram, &sysram, &swapped);
+	if (ret) {
+		printf("gem_residency failed ret = %d\n", ret);
+		return ret;
+	}
+	
+	printf("residency: vram %llu kB, sysram %llu kB, swapped %llu kB\n  ",
+	       (unsigned long long) vram >> 10,
+	       (unsigned long long) sysram >> 10,
+	       (unsigned long long) swapped >> 10);
+	
+	for (i = 0; i < n_chunks && i < 1024; i++) {
+		printf("%c", state[PSCNV_RESIDENCY_GET(residency, i)]);
+	}
+	printf("\n");
+	
+	return 0;
+}
+
+int
+main()
+{
+	int fd;
+	int ret;
+	uint32_t gem_handle;
+	
+	fd = drmOpen("pscnv", 0);
+
+	if (fd == -1) {
+		printf("failed to open DRM device\n");
+		return 1;
+	}
+	
+	ret = print_budget(fd, "initial");
+	if (ret)
+		goto out;
+	
+	ret = pscnv_gem_new(fd, 0xb0d6e7, PSCNV_GEM_VRAM_SMALL, 0,
+			    TEST_GEM_SIZE, NULL, &gem_handle, NULL);
+	if (ret) {
+		printf("gem_new failed ret = %d\n", ret);
+		goto out;
+	}
+	
+	ret = print_budget(fd, "after gem_new");
+	if (!ret)
+		ret = print_residency(fd, gem_handle);
+	
+	pscnv_gem_close(fd, gem_handle);
+	
+	if (!ret)
+		ret = print_budget(fd, "after gem_close");
+
+out:
+	close (fd);
+	
+	return ret ? 1 : 0;
+}